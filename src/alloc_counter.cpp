@@ -0,0 +1,173 @@
+/*
+ *
+ * Copyright: 2023 Ilya Popov <ilya.popov@isteq.nl>, ISTEQ BV
+ *
+ * SPDX-License-Identifier: GPL3.0-or-later
+ *
+ */
+
+#include "alloc_counter.hpp"
+#include "huge_pages.hpp"
+
+#include <atomic>
+#include <cstdlib>
+#include <fstream>
+#include <iomanip>
+#include <new>
+#include <ostream>
+#include <sstream>
+
+namespace {
+
+std::atomic<std::uint64_t> allocation_count{0};
+std::atomic<std::uint64_t> allocated_bytes{0};
+
+void release(void* p)
+{
+    if (!Foam::fve::huge_page_free(p)) {
+        std::free(p);
+    }
+}
+
+void* counted_allocate(std::size_t size)
+{
+    allocation_count.fetch_add(1, std::memory_order_relaxed);
+    allocated_bytes.fetch_add(size, std::memory_order_relaxed);
+    if (void* p = Foam::fve::huge_page_allocate(size)) {
+        return p;
+    }
+    return std::malloc(size == 0 ? 1 : size);
+}
+
+void* counted_allocate_or_throw(std::size_t size)
+{
+    for (;;) {
+        void* p = counted_allocate(size);
+        if (p != nullptr) {
+            return p;
+        }
+        std::new_handler handler = std::get_new_handler();
+        if (handler == nullptr) {
+            throw std::bad_alloc();
+        }
+        handler();
+    }
+}
+
+} // namespace
+
+void* operator new(std::size_t size)
+{
+    return counted_allocate_or_throw(size);
+}
+
+void* operator new[](std::size_t size)
+{
+    return counted_allocate_or_throw(size);
+}
+
+void* operator new(std::size_t size, const std::nothrow_t&) noexcept
+{
+    return counted_allocate(size);
+}
+
+void* operator new[](std::size_t size, const std::nothrow_t&) noexcept
+{
+    return counted_allocate(size);
+}
+
+void operator delete(void* p) noexcept
+{
+    release(p);
+}
+
+void operator delete[](void* p) noexcept
+{
+    release(p);
+}
+
+void operator delete(void* p, std::size_t) noexcept
+{
+    release(p);
+}
+
+void operator delete[](void* p, std::size_t) noexcept
+{
+    release(p);
+}
+
+void operator delete(void* p, const std::nothrow_t&) noexcept
+{
+    release(p);
+}
+
+void operator delete[](void* p, const std::nothrow_t&) noexcept
+{
+    release(p);
+}
+
+Foam::fve::allocation_counters Foam::fve::allocations()
+{
+    allocation_counters c;
+    c.allocations = allocation_count.load(std::memory_order_relaxed);
+    c.bytes = allocated_bytes.load(std::memory_order_relaxed);
+    return c;
+}
+
+std::size_t Foam::fve::peak_rss()
+{
+    std::ifstream status("/proc/self/status");
+    std::string line;
+    while (std::getline(status, line)) {
+        if (line.compare(0, 6, "VmHWM:") == 0) {
+            std::istringstream is(line.substr(6));
+            std::size_t kb = 0;
+            is >> kb;
+            return kb*1024;
+        }
+    }
+    return 0;
+}
+
+bool Foam::fve::reset_peak_rss()
+{
+    std::ofstream clear_refs("/proc/self/clear_refs");
+    clear_refs << "5";
+    clear_refs.flush();
+    return static_cast<bool>(clear_refs);
+}
+
+void Foam::fve::write_csv_with_memory(const std::string& csv, const std::vector<memory_usage>& usage, std::ostream& os)
+{
+    std::istringstream is(csv);
+    std::string line;
+
+    const std::ios_base::fmtflags flags = os.flags();
+    const std::streamsize precision = os.precision();
+    os << std::fixed << std::setprecision(1);
+
+    if (std::getline(is, line)) {
+        os << line << ";\"allocations/iteration\";\"bytes/iteration\";\"peak RSS\"\n";
+    }
+
+    size_t i = 0;
+    while (std::getline(is, line)) {
+        if (line.empty()) {
+            continue;
+        }
+        os << line;
+        if (i < usage.size()) {
+            os << ';' << usage[i].allocations_per_iteration
+               << ';' << usage[i].bytes_per_iteration
+               << ';' << usage[i].peak_rss;
+        }
+        else {
+            os << ";;;";
+        }
+        os << '\n';
+        i++;
+    }
+
+    os.flags(flags);
+    os.precision(precision);
+}
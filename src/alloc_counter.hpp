@@ -0,0 +1,72 @@
+/*
+ *
+ * Copyright: 2023 Ilya Popov <ilya.popov@isteq.nl>, ISTEQ BV
+ *
+ * SPDX-License-Identifier: GPL3.0-or-later
+ *
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <iosfwd>
+#include <string>
+#include <vector>
+
+namespace Foam {
+namespace fve {
+
+// Number and total size of allocations made through global operator new
+// (and so by Foam::List, tmp fields and std containers) since the program
+// started, in all threads. Linking alloc_counter.cpp replaces the global
+// operator new and delete; direct malloc() calls are not counted. Large
+// allocations may be backed by huge pages, see huge_pages.hpp.
+struct allocation_counters {
+    std::uint64_t allocations = 0;
+    std::uint64_t bytes = 0;
+};
+
+allocation_counters allocations();
+
+// Peak resident set size of the process in bytes (VmHWM), 0 if unknown
+std::size_t peak_rss();
+
+// Resets the peak resident set size to the current one (Linux 4.0 and newer).
+// Returns false if this is not supported, then peak_rss() keeps the peak
+// since the start of the program.
+bool reset_peak_rss();
+
+// Memory used by one benchmark variant
+struct memory_usage {
+    double allocations_per_iteration = 0;
+    double bytes_per_iteration = 0;
+    std::size_t peak_rss = 0;
+};
+
+// Runs op the given number of times and reports its allocations per
+// iteration and the peak resident set size while it ran. Meant to be called
+// next to the timed runs, so counting does not disturb the timings.
+template <typename Op>
+memory_usage measure_memory(Op&& op, int iterations = 3)
+{
+    reset_peak_rss();
+    const allocation_counters before = allocations();
+    for (int i = 0; i < iterations; i++) {
+        op();
+    }
+    const allocation_counters after = allocations();
+
+    memory_usage usage;
+    usage.allocations_per_iteration = static_cast<double>(after.allocations - before.allocations)/iterations;
+    usage.bytes_per_iteration = static_cast<double>(after.bytes - before.bytes)/iterations;
+    usage.peak_rss = peak_rss();
+    return usage;
+}
+
+// Writes a csv rendered by nanobench (templates::csv(), one line per result)
+// with the memory usage of every result appended as extra columns
+void write_csv_with_memory(const std::string& csv, const std::vector<memory_usage>& usage, std::ostream& os);
+
+} // namespace fve
+} // namespace Foam
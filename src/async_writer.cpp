@@ -0,0 +1,152 @@
+/*
+ *
+ * Copyright: 2023 Ilya Popov <ilya.popov@isteq.nl>, ISTEQ BV
+ *
+ * SPDX-License-Identifier: GPL3.0-or-later
+ *
+ */
+
+#include "async_writer.hpp"
+#include "thread_pool.hpp"
+
+#include <algorithm>
+#include <cstdlib>
+
+#include <pthread.h>
+
+namespace {
+
+size_t env_megabytes(const char* name, size_t default_value)
+{
+    const char* s = std::getenv(name);
+    if (s == nullptr || *s == '\0') {
+        return default_value << 20;
+    }
+    return static_cast<size_t>(std::atol(s)) << 20;
+}
+
+double seconds(std::chrono::steady_clock::duration d)
+{
+    return std::chrono::duration<double>(d).count();
+}
+
+} // namespace
+
+Foam::fve::async_writer::async_writer()
+    : async_writer(env_megabytes("FVE_ASYNC_WRITE_BUFFER_MB", 1024))
+{}
+
+Foam::fve::async_writer::async_writer(size_t buffer_bytes)
+    : buffer_bytes(buffer_bytes)
+    , affinity(thread_pool::instance().process_affinity())
+    , thread([this] { worker(); })
+{}
+
+Foam::fve::async_writer::~async_writer()
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stop = true;
+    }
+    job_added.notify_one();
+    thread.join();
+}
+
+void Foam::fve::async_writer::reserve(size_t bytes)
+{
+    const auto start = clock::now();
+
+    std::unique_lock<std::mutex> lock(mutex);
+    // A snapshot larger than the whole buffer is let through once the
+    // buffer is empty
+    job_done.wait(lock, [&] {
+        return buffered_bytes == 0 || buffered_bytes + bytes <= buffer_bytes;
+    });
+    buffered_bytes += bytes;
+    counters.peak_buffered_bytes = std::max(counters.peak_buffered_bytes, buffered_bytes);
+    counters.wait_seconds += seconds(clock::now() - start);
+}
+
+void Foam::fve::async_writer::enqueue(std::unique_ptr<Foam::regIOobject> snapshot, size_t bytes, clock::time_point start)
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        queue.push_back(job{std::move(snapshot), bytes});
+        counters.snapshots++;
+        counters.stall_seconds += seconds(clock::now() - start);
+    }
+    job_added.notify_one();
+}
+
+void Foam::fve::async_writer::record_synchronous(size_t bytes, clock::time_point start)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    counters.snapshots++;
+    counters.written_bytes += bytes;
+    counters.stall_seconds += seconds(clock::now() - start);
+}
+
+void Foam::fve::async_writer::flush()
+{
+    const auto start = clock::now();
+
+    std::unique_lock<std::mutex> lock(mutex);
+    job_done.wait(lock, [&] {
+        return queue.empty() && !busy;
+    });
+    counters.flush_seconds += seconds(clock::now() - start);
+}
+
+Foam::fve::async_writer::statistics Foam::fve::async_writer::stats() const
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    return counters;
+}
+
+void Foam::fve::async_writer::report(Ostream& os) const
+{
+    const statistics s = stats();
+    os << "Async writer: " << s.snapshots << " fields, "
+       << label(s.written_bytes >> 20) << " MiB written in " << s.write_seconds << " s, "
+       << "caller stalled " << s.stall_seconds << " s (" << s.wait_seconds << " s waiting for buffer), "
+       << "flush " << s.flush_seconds << " s, "
+       << "peak buffer " << label(s.peak_buffered_bytes >> 20) << " MiB" << nl;
+}
+
+void Foam::fve::async_writer::worker()
+{
+    // The thread pool pins the thread that creates it, and this thread
+    // inherited that mask. Writing has to overlap the time step, so it must
+    // not compete for the solver's core.
+    if (CPU_COUNT(&affinity) > 0) {
+        pthread_setaffinity_np(pthread_self(), sizeof(affinity), &affinity);
+    }
+
+    std::unique_lock<std::mutex> lock(mutex);
+    for (;;) {
+        job_added.wait(lock, [&] {
+            return stop || !queue.empty();
+        });
+        if (queue.empty()) {
+            // stop requested and everything written
+            return;
+        }
+
+        job j = std::move(queue.front());
+        queue.pop_front();
+        busy = true;
+        lock.unlock();
+
+        const auto start = clock::now();
+        j.object->write();
+        j.object.reset();
+        const double elapsed = seconds(clock::now() - start);
+
+        lock.lock();
+        busy = false;
+        buffered_bytes -= j.bytes;
+        counters.written_bytes += j.bytes;
+        counters.write_seconds += elapsed;
+        job_done.notify_all();
+    }
+}
@@ -0,0 +1,136 @@
+/*
+ *
+ * Copyright: 2023 Ilya Popov <ilya.popov@isteq.nl>, ISTEQ BV
+ *
+ * SPDX-License-Identifier: GPL3.0-or-later
+ *
+ */
+
+#pragma once
+
+#include "GeometricField.H"
+#include "Ostream.H"
+#include "Pstream.H"
+#include "regIOobject.H"
+
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <thread>
+
+#include <sched.h>
+
+namespace Foam {
+namespace fve {
+
+// Writes fields on a background thread. write() copies the field into a
+// snapshot and returns, the snapshot is serialised and written to disk while
+// the caller continues with the next time step. Snapshots waiting to be
+// written take at most buffer_bytes; when the buffer is full write() waits
+// for the writer thread, so memory stays bounded.
+//
+// In parallel runs writing may communicate, which must not happen on a
+// background thread, so there fields are written synchronously.
+class async_writer {
+public:
+    struct statistics {
+        Foam::label snapshots = 0;
+        // Time spent in write() by the caller, including waiting for space
+        double stall_seconds = 0;
+        // Of it, time spent waiting for the buffer
+        double wait_seconds = 0;
+        // Time spent in flush() waiting for the queue to drain, not part of
+        // stall_seconds
+        double flush_seconds = 0;
+        // Time spent by the writer thread
+        double write_seconds = 0;
+        size_t written_bytes = 0;
+        size_t peak_buffered_bytes = 0;
+    };
+
+    // Default buffer size is taken from FVE_ASYNC_WRITE_BUFFER_MB environment
+    // variable, 1024 MiB if not set
+    async_writer();
+    explicit async_writer(size_t buffer_bytes);
+
+    // Waits until all snapshots are written
+    ~async_writer();
+
+    async_writer(const async_writer&) = delete;
+    async_writer& operator=(const async_writer&) = delete;
+
+    // Snapshots f in its current state, to be written into the current time
+    // directory in the format set up in controlDict
+    template <typename Type, template<class> class PatchField, typename GeoMesh>
+    void write(const Foam::GeometricField<Type, PatchField, GeoMesh>& f)
+    {
+        using field_type = Foam::GeometricField<Type, PatchField, GeoMesh>;
+
+        const auto start = clock::now();
+
+        if (Foam::Pstream::parRun()) {
+            f.write();
+            record_synchronous(f.size() * sizeof(Type), start);
+            return;
+        }
+
+        size_t bytes = f.size() * sizeof(Type);
+        for (const auto& patchField: f.boundaryField()) {
+            bytes += patchField.size() * sizeof(Type);
+        }
+        reserve(bytes);
+
+        std::unique_ptr<Foam::regIOobject> snapshot(new field_type(
+            Foam::IOobject(f.name(), f.time().timeName(), f.db(),
+                           Foam::IOobject::NO_READ, Foam::IOobject::NO_WRITE, false),
+            f));
+
+        enqueue(std::move(snapshot), bytes, start);
+    }
+
+    // Waits until all snapshots are written
+    void flush();
+
+    statistics stats() const;
+
+    void report(Foam::Ostream& os) const;
+
+private:
+    using clock = std::chrono::steady_clock;
+
+    struct job {
+        std::unique_ptr<Foam::regIOobject> object;
+        size_t bytes;
+    };
+
+    // Waits until the buffer has space for bytes more
+    void reserve(size_t bytes);
+
+    void enqueue(std::unique_ptr<Foam::regIOobject> snapshot, size_t bytes, clock::time_point start);
+
+    void record_synchronous(size_t bytes, clock::time_point start);
+
+    void worker();
+
+    const size_t buffer_bytes;
+
+    mutable std::mutex mutex;
+    std::condition_variable job_added;
+    std::condition_variable job_done;
+    std::deque<job> queue;
+    // Bytes of snapshots queued or being written
+    size_t buffered_bytes = 0;
+    bool busy = false;
+    bool stop = false;
+    statistics counters;
+
+    // Affinity mask of the process for the writer thread, see worker()
+    const cpu_set_t affinity;
+
+    std::thread thread;
+};
+
+} // namespace fve
+} // namespace Foam
@@ -0,0 +1,308 @@
+/*
+ *
+ * Copyright: 2023 Ilya Popov <ilya.popov@isteq.nl>, ISTEQ BV
+ *
+ * SPDX-License-Identifier: GPL3.0-or-later
+ *
+ */
+
+#pragma once
+
+#include "expressions.hpp"
+#include "process_microdomains.hpp"
+
+#include "GeometricField.H"
+
+#include <vector>
+
+namespace Foam {
+namespace fve {
+
+// N scalars stored next to each other, e.g. mass fractions of all species in
+// one cell. Arithmetic is element-wise, so an expression evaluated on batches
+// processes all scalars in one traversal of the mesh, and the loops over the
+// batch are vectorised by the compiler.
+template <int N>
+struct scalar_batch {
+    static constexpr int size = N;
+
+    Foam::scalar v[N];
+
+    scalar_batch() = default;
+
+    scalar_batch(const Foam::zero&) {
+        for (int i = 0; i < N; i++) {
+            v[i] = 0;
+        }
+    }
+
+    Foam::scalar& operator[](int i) { return v[i]; }
+    Foam::scalar operator[](int i) const { return v[i]; }
+
+    scalar_batch& operator+=(const scalar_batch& b) {
+        for (int i = 0; i < N; i++) {
+            v[i] += b.v[i];
+        }
+        return *this;
+    }
+
+    scalar_batch& operator-=(const scalar_batch& b) {
+        for (int i = 0; i < N; i++) {
+            v[i] -= b.v[i];
+        }
+        return *this;
+    }
+};
+
+#define FVE_BATCH_OPERATOR(op, lhs_type, rhs_type, lhs_elem, rhs_elem) \
+template <int N>                                                      \
+inline scalar_batch<N> operator op(lhs_type a, rhs_type b) {         \
+    scalar_batch<N> r;                                               \
+    for (int i = 0; i < N; i++) {                                    \
+        r.v[i] = lhs_elem op rhs_elem;                               \
+    }                                                                \
+    return r;                                                        \
+}
+
+FVE_BATCH_OPERATOR(+, const scalar_batch<N>&, const scalar_batch<N>&, a.v[i], b.v[i])
+FVE_BATCH_OPERATOR(-, const scalar_batch<N>&, const scalar_batch<N>&, a.v[i], b.v[i])
+FVE_BATCH_OPERATOR(*, const scalar_batch<N>&, const scalar_batch<N>&, a.v[i], b.v[i])
+FVE_BATCH_OPERATOR(/, const scalar_batch<N>&, const scalar_batch<N>&, a.v[i], b.v[i])
+FVE_BATCH_OPERATOR(*, Foam::scalar, const scalar_batch<N>&, a, b.v[i])
+FVE_BATCH_OPERATOR(*, const scalar_batch<N>&, Foam::scalar, a.v[i], b)
+FVE_BATCH_OPERATOR(/, const scalar_batch<N>&, Foam::scalar, a.v[i], b)
+
+#undef FVE_BATCH_OPERATOR
+
+template <int N>
+inline scalar_batch<N> operator-(const scalar_batch<N>& a) {
+    scalar_batch<N> r;
+    for (int i = 0; i < N; i++) {
+        r.v[i] = -a.v[i];
+    }
+    return r;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+
+// Vol or surface field of scalar batches, for transporting many scalars with
+// the same expression. Provides the parts of the GeometricField interface the
+// expressions use. Values of the individual scalars are copied in and out of
+// ordinary fields with load and store.
+template <int N, typename GeoMesh>
+class batched_field {
+public:
+    using value_type = scalar_batch<N>;
+    using Boundary = std::vector<std::vector<value_type>>;
+    static constexpr loc location = Foam::isVolMesh<GeoMesh>::value ? loc::cell : loc::face;
+
+    batched_field(const Foam::fvMesh& mesh, const Foam::dimensionSet& dims)
+        : mesh_(mesh)
+        , dims(dims)
+        , internal(location == loc::cell ? mesh.nCells() : mesh.nInternalFaces(), value_type(Foam::Zero))
+        , boundary(mesh.boundary().size())
+    {
+        forAll(mesh.boundary(), patchi) {
+            boundary[patchi].assign(mesh.boundary()[patchi].size(), value_type(Foam::Zero));
+        }
+    }
+
+    batched_field& operator=(const Foam::zero&) {
+        for (auto& v: internal) {
+            v = Foam::Zero;
+        }
+        return *this;
+    }
+
+    // Copies scalar field f into scalar i of the batches
+    template <template<class> class PatchField>
+    void load(int i, const Foam::GeometricField<Foam::scalar, PatchField, GeoMesh>& f) {
+        forAll(f.primitiveField(), elemi) {
+            internal[elemi][i] = f[elemi];
+        }
+        forAll(f.boundaryField(), patchi) {
+            forAll(f.boundaryField()[patchi], facei) {
+                boundary[patchi][facei][i] = f.boundaryField()[patchi][facei];
+            }
+        }
+    }
+
+    // Copies scalar i of the batches into field f
+    template <template<class> class PatchField>
+    void store(int i, Foam::GeometricField<Foam::scalar, PatchField, GeoMesh>& f) const {
+        forAll(f.primitiveField(), elemi) {
+            f[elemi] = internal[elemi][i];
+        }
+        forAll(f.boundaryField(), patchi) {
+            forAll(f.boundaryField()[patchi], facei) {
+                f.boundaryFieldRef()[patchi][facei] = boundary[patchi][facei][i];
+            }
+        }
+    }
+
+    value_type& operator[](Foam::label i) { return internal[i]; }
+    const value_type& operator[](Foam::label i) const { return internal[i]; }
+
+    Foam::label size() const { return internal.size(); }
+
+    const Boundary& boundaryField() const { return boundary; }
+    Boundary& boundaryFieldRef() { return boundary; }
+
+    const Foam::fvMesh& mesh() const { return mesh_; }
+
+    const Foam::dimensionSet& dimensions() const { return dims; }
+    Foam::dimensionSet& dimensions() { return dims; }
+
+private:
+    const Foam::fvMesh& mesh_;
+    Foam::dimensionSet dims;
+    std::vector<value_type> internal;
+    Boundary boundary;
+};
+
+template <int N>
+using vol_batched_field = batched_field<N, Foam::volMesh>;
+
+template <int N>
+using surface_batched_field = batched_field<N, Foam::surfaceMesh>;
+
+///////////////////////////////////////////////////////////////////////////////
+
+template <int N, typename GeoMesh>
+struct field_expr<batched_field<N, GeoMesh>> {
+
+    using value_type = scalar_batch<N>;
+    static constexpr loc location = batched_field<N, GeoMesh>::location;
+    static constexpr bool has_surface_integrate = false;
+    static constexpr int integrate_depth = 0;
+    using field_type = batched_field<N, GeoMesh>;
+
+    const field_type& field;
+
+    field_expr(const field_type& f)
+        : field(f)
+    {}
+
+    const value_type& operator [](Foam::label i) const {
+        return field[i];
+    }
+
+    const value_type& on_boundary(Foam::label patchi, Foam::label facei) const {
+        return field.boundaryField()[patchi][facei];
+    }
+
+    const Foam::fvMesh& mesh() const {
+        return field.mesh();
+    }
+
+    Foam::dimensionSet dimensions() const {
+        return field.dimensions();
+    }
+};
+
+template <int N, typename GeoMesh>
+auto read(const batched_field<N, GeoMesh>& f) -> field_expr<batched_field<N, GeoMesh>> {
+    return {f};
+}
+
+///////////////////////////////////////////////////////////////////////////////
+
+template <int N, typename GeoMesh, typename Expression>
+void assign_boundary(batched_field<N, GeoMesh>& f, const Expression& e)
+{
+    auto& boundary = f.boundaryFieldRef();
+    for (size_t patchi = 0; patchi < boundary.size(); patchi++) {
+        for (size_t facei = 0; facei < boundary[patchi].size(); facei++) {
+            boundary[patchi][facei] = e.on_boundary(patchi, facei);
+        }
+    }
+}
+
+template <int N, typename GeoMesh, typename Expression,
+         typename std::enable_if<!Expression::has_surface_integrate, int>::type = 0>
+[[gnu::noinline]]
+void operator<<=(batched_field<N, GeoMesh>& f, Expression e)
+{
+    static_assert(Expression::location == batched_field<N, GeoMesh>::location,
+                  "Expression must have same location (cell or face) as the target field");
+
+    if (!e.dimensions().dimensionless()) {
+        // Check dimensions
+        f.dimensions() = e.dimensions();
+    }
+
+    parallel_for(0, f.size(), [&](Foam::label begin, Foam::label end) {
+        for_each_element(e, begin, end, [&](Foam::label i) {
+            f[i] = e[i];
+        });
+    });
+
+    assign_boundary(f, e);
+}
+
+// Same as f <<= e, in the order of microdomains
+template <int N, typename GeoMesh, typename Expression,
+         typename std::enable_if<!Expression::has_surface_integrate, int>::type = 0>
+[[gnu::noinline]]
+void assign(batched_field<N, GeoMesh>& f, const microdomains& mds, Expression e)
+{
+    static_assert(Expression::location == batched_field<N, GeoMesh>::location,
+                  "Expression must have same location (cell or face) as the target field");
+
+    if (!e.dimensions().dimensionless()) {
+        // Check dimensions
+        f.dimensions() = e.dimensions();
+    }
+
+    auto& boundary = f.boundaryFieldRef();
+    assign_by_microdomains(e, mds, [&](Foam::label i) {
+        f[i] = e[i];
+    }, [&](Foam::label patchi, Foam::label facei) {
+        boundary[patchi][facei] = e.on_boundary(patchi, facei);
+    });
+}
+
+template <int N, typename Expression,
+         typename std::enable_if<Expression::has_surface_integrate, int>::type = 0>
+[[gnu::noinline]]
+void operator<<=(vol_batched_field<N>& f, Expression e)
+{
+    static_assert(Expression::location == loc::cell,
+                  "Expression must have same location (cell or face) as the target field");
+
+    if (!e.dimensions().dimensionless()) {
+        // Check dimensions
+        f.dimensions() = e.dimensions();
+    }
+
+    auto& boundary = f.boundaryFieldRef();
+    assign_microdomain_cells(e, [&](Foam::label celli) {
+        f[celli] = e[celli];
+    }, [&](Foam::label patchi, Foam::label facei) {
+        boundary[patchi][facei] = e.on_boundary(patchi, facei);
+    });
+}
+
+template <int N, typename Expression,
+         typename std::enable_if<Expression::has_surface_integrate, int>::type = 0>
+[[gnu::noinline]]
+void operator<<=(surface_batched_field<N>& f, Expression e)
+{
+    static_assert(Expression::location == loc::face,
+                  "Expression must have same location (cell or face) as the target field");
+
+    if (!e.dimensions().dimensionless()) {
+        // Check dimensions
+        f.dimensions() = e.dimensions();
+    }
+
+    auto& boundary = f.boundaryFieldRef();
+    assign_microdomain_faces(e, [&](Foam::label facei) {
+        f[facei] = e[facei];
+    }, [&](Foam::label patchi, Foam::label facei) {
+        boundary[patchi][facei] = e.on_boundary(patchi, facei);
+    });
+}
+
+} // namespace fve
+} // namespace Foam
@@ -0,0 +1,105 @@
+/*
+ *
+ * Copyright: 2023 Ilya Popov <ilya.popov@isteq.nl>, ISTEQ BV
+ *
+ * SPDX-License-Identifier: GPL3.0-or-later
+ *
+ */
+
+#include "change_tracker.hpp"
+
+#include "defineDebugSwitch.H"
+
+namespace Foam {
+namespace fve {
+
+defineTypeNameAndDebug(change_tracker, 0);
+
+} // namespace fve
+} // namespace Foam
+
+Foam::fve::change_tracker::change_tracker(const fvMesh& mesh)
+    : Foam::MeshObject<Foam::fvMesh, Foam::TopologicalMeshObject, change_tracker>(mesh)
+{}
+
+Foam::fve::change_tracker::~change_tracker()
+{
+
+}
+
+const Foam::fve::microdomains& Foam::fve::change_tracker::domains() const
+{
+    return microdomains::New(mesh());
+}
+
+void Foam::fve::change_tracker::mark_changed(const void* field) const
+{
+    mark_changed(field, std::vector<char>(domains().domains.size(), 1));
+}
+
+void Foam::fve::change_tracker::mark_changed(const void* field, const std::vector<char>& mask) const
+{
+    auto& v = versions[field];
+    if (v.empty()) {
+        v.assign(domains().domains.size(), 0);
+    }
+    for (size_t d = 0; d < v.size(); ++d) {
+        if (mask[d]) {
+            v[d]++;
+        }
+    }
+}
+
+void Foam::fve::change_tracker::forget(const void* field) const
+{
+    versions.erase(field);
+    targets.erase(field);
+    for (auto it = seen.begin(); it != seen.end(); ) {
+        if (it->first.first == field || it->first.second == field) {
+            it = seen.erase(it);
+        }
+        else {
+            ++it;
+        }
+    }
+}
+
+std::vector<char> Foam::fve::change_tracker::changed_domains(const void* target, const std::vector<const void*>& inputs) const
+{
+    const size_t n_domains = domains().domains.size();
+    std::vector<char> changed(n_domains, 0);
+
+    for (const void* input: inputs) {
+        auto v = versions.find(input);
+        if (v == versions.end()) {
+            // not tracked, may have changed anywhere
+            changed.assign(n_domains, 1);
+            continue;
+        }
+
+        auto& s = seen[std::make_pair(target, input)];
+        if (s.empty()) {
+            changed.assign(n_domains, 1);
+        }
+        else {
+            for (size_t d = 0; d < n_domains; ++d) {
+                if (s[d] != v->second[d]) {
+                    changed[d] = 1;
+                }
+            }
+        }
+        s = v->second;
+    }
+
+    if (targets.insert(target).second) {
+        // first update of a target computes everything
+        changed.assign(n_domains, 1);
+    }
+
+    return changed;
+}
+
+std::vector<char> Foam::fve::change_tracker::expand(const std::vector<char>& mask) const
+{
+    return fve::expand(domains(), mask);
+}
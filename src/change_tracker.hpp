@@ -0,0 +1,169 @@
+/*
+ *
+ * Copyright: 2023 Ilya Popov <ilya.popov@isteq.nl>, ISTEQ BV
+ *
+ * SPDX-License-Identifier: GPL3.0-or-later
+ *
+ */
+
+#pragma once
+
+#include "expressions.hpp"
+
+#include "microdomains.hpp"
+#include "process_microdomains.hpp"
+#include "thread_pool.hpp"
+
+#include "fvMesh.H"
+#include "MeshObject.H"
+
+#include <map>
+#include <set>
+#include <utility>
+#include <vector>
+
+namespace Foam {
+namespace fve {
+
+// Per-microdomain versions of fields, used by update() to recompute only
+// the parts of the mesh whose inputs changed.
+//
+// A field is tracked once it has been marked changed or written by update().
+// Fields modified in any other way (OpenFOAM operators, plain <<=, manual
+// loops) must be marked with mark_changed() afterwards, otherwise update()
+// does not see the change. Inputs that are not tracked are treated as
+// changed everywhere. Fields are identified by their address.
+class change_tracker : public Foam::MeshObject<Foam::fvMesh, Foam::TopologicalMeshObject, change_tracker> {
+public:
+    TypeName("change_tracker");
+
+    explicit change_tracker(const Foam::fvMesh& mesh);
+    virtual ~change_tracker();
+
+    // Marks all domains of a field changed
+    void mark_changed(const void* field) const;
+
+    // Marks domains d with mask[d] != 0 changed
+    void mark_changed(const void* field, const std::vector<char>& mask) const;
+
+    // Stops tracking a field, e.g. before it is destroyed
+    void forget(const void* field) const;
+
+    // Returns the mask of domains in which any of the inputs changed since
+    // the last call for the same target, and remembers current versions
+    std::vector<char> changed_domains(const void* target, const std::vector<const void*>& inputs) const;
+
+    // Adds the neighbours of all domains in mask to it
+    std::vector<char> expand(const std::vector<char>& mask) const;
+
+private:
+    // Looked up on every use rather than kept, so that the tracker never
+    // holds on to domains the mesh has replaced
+    const microdomains& domains() const;
+
+    mutable std::map<const void*, std::vector<unsigned>> versions;
+    // Versions of inputs seen by the last update of each (target, input) pair
+    mutable std::map<std::pair<const void*, const void*>, std::vector<unsigned>> seen;
+    mutable std::set<const void*> targets;
+};
+
+///////////////////////////////////////////////////////////////////////////////
+
+// Collects addresses of the fields an expression reads
+template <typename Expr>
+void collect_inputs(const Expr& e, std::vector<const void*>& inputs) {
+    for_each_child(e, [&](const auto& child) {
+        collect_inputs(child, inputs);
+    });
+}
+
+template <typename Field>
+void collect_inputs(const field_expr<Field>& e, std::vector<const void*>& inputs) {
+    inputs.push_back(&e.field);
+}
+
+// Same as f <<= e, but recomputes only microdomains that can be affected by
+// changes of the fields e reads since the previous update of f: the changed
+// domains and, for every level of surface integrals, one more layer of their
+// neighbours, plus one layer for gathers outside of surface integrals.
+// Domains written are marked changed in f. Physical boundary faces are
+// assigned with the domain of their face cell, coupled patches every time.
+//
+// Surface integral fields are reset by update() itself on the recomputed
+// cells, so unlike with <<= they need not be zeroed. They must not be
+// modified by anything else between updates.
+template <typename Type, template<class> class PatchField, typename GeoMesh, typename Expression>
+[[gnu::noinline]]
+void update(Foam::GeometricField<Type, PatchField, GeoMesh>& f, Expression e)
+{
+    static_assert(Expression::location == (Foam::isVolMesh<GeoMesh>::value ? loc::cell : loc::face),
+                  "Expression must have same location (cell or face) as the target field");
+    const fvMesh& mesh = e.mesh();
+
+    if (!e.dimensions().dimensionless()) {
+        // Check dimensions
+        f.dimensions() = e.dimensions();
+    }
+
+    const auto& mds = microdomains::New(mesh);
+    const auto& tracker = change_tracker::New(mesh);
+
+    std::vector<const void*> inputs;
+    collect_inputs(e, inputs);
+
+    // masks[level]: domains whose values of the given level of surface
+    // integrals are recomputed, the last one is the result
+    std::vector<std::vector<char>> masks(Expression::integrate_depth + 1);
+    masks[0] = tracker.expand(tracker.changed_domains(&f, inputs));
+    for (int level = 1; level <= Expression::integrate_depth; ++level) {
+        masks[level] = tracker.expand(masks[level - 1]);
+    }
+    const std::vector<char>& result_mask = masks.back();
+
+    // Domains next to the recomputed ones contribute to them through their
+    // own_boundary_faces
+    std::vector<std::vector<char>> reach(Expression::integrate_depth + 1);
+    for (int level = 1; level <= Expression::integrate_depth; ++level) {
+        reach[level] = tracker.expand(masks[level]);
+    }
+
+    auto& bf = f.boundaryFieldRef();
+    auto assign_patch_face = [&](Foam::label patchi, Foam::label facei, Foam::label) {
+        bf[patchi][facei] = e.on_boundary(patchi, facei);
+    };
+
+    thread_pool::instance().run([&](const thread_pool::team& t) {
+        process_microdomains(e, mds, masks, reach, t);
+
+        chunk c(0, mds.groups.size(), t);
+        for (Foam::label g = c.begin; g < c.end; ++g) {
+            for (auto d: mds.groups[g].domains) {
+                if (!result_mask[d]) {
+                    continue;
+                }
+                const auto& md = mds.domains[d];
+                if (Expression::location == loc::cell) {
+                    for (auto celli: md.cells) {
+                        f[celli] = e[celli];
+                    }
+                }
+                else {
+                    for (auto facei: md.internal_faces) {
+                        f[facei] = e[facei];
+                    }
+                    for (auto facei: md.own_boundary_faces) {
+                        f[facei] = e[facei];
+                    }
+                }
+                for_each_patch_face(mds, md, assign_patch_face);
+            }
+        }
+    });
+
+    for_each_coupled_patch_face(mesh, mds, assign_patch_face);
+
+    tracker.mark_changed(&f, result_mask);
+}
+
+} // namespace fve
+} // namespace Foam
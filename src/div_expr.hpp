@@ -11,6 +11,9 @@
 #include "expressions.hpp"
 
 #include "microdomains.hpp"
+#include "face_colouring.hpp"
+
+#include "process_microdomains.hpp"
 
 namespace Foam {
 namespace fve {
@@ -24,53 +27,118 @@ enum class where {
 template<typename Field, typename FaceExpr>
 struct surface_integrate_expr {
     using value_type = typename FaceExpr::value_type;
-    static_assert(FaceExpr::location == loc::face, "Argument to gradient must be cell expression");
-    static_assert(!FaceExpr::has_surface_integrate, "More than one level of surface integrate expressions is not handled");
+    static_assert(FaceExpr::location == loc::face, "Argument to surface integral must be face expression");
     static constexpr loc location = loc::cell;
     static constexpr bool has_surface_integrate = true;
+    // Nested surface integrals are processed one level after another in a
+    // wavefront over microdomains, see process_microdomains.hpp
+    static constexpr int integrate_depth = FaceExpr::integrate_depth + 1;
 
     Field& field;
     FaceExpr nested;
     const Foam::labelUList& owner;
     const Foam::labelUList& neighbour;
     const DimensionedField<scalar, volMesh>& V;
+    const microdomains& mds;
+    // Set if faces are processed colour by colour, see face_colouring.hpp
+    const face_colouring* colouring;
 
-    surface_integrate_expr(const Field& field, const FaceExpr& arg)
+    surface_integrate_expr(Field& field, const FaceExpr& arg)
         : field(field)
         , nested(arg)
         , owner(arg.mesh().owner())
         , neighbour(arg.mesh().neighbour())
         , V(nested.mesh().V())
-    {
-        const fvMesh& mesh = arg.mesh();
-        for (label patchi = 0; patchi < mesh.boundary().size(); ++patchi) {
-            const auto& patch = mesh.boundary()[patchi];
-            const auto& pFaceCells = patch.faceCells();
-
-            for (label facei = 0; facei < patch.size(); facei++) {
-                label celli = pFaceCells[facei];
+        , mds(microdomains::New(arg.mesh()))
+        , colouring(colour_faces() ? &face_colouring::New(arg.mesh()) : nullptr)
+    {}
+
+    // Contributions of coupled patches are added by process_boundary before
+    // the microdomains are processed, those of physical boundary faces with
+    // the faces of their domain
+    template <typename Include>
+    void process_boundary_faces(const Include& include) const {
+        for_each_coupled_patch_face(nested.mesh(), mds, [&](label patchi, label facei, label celli) {
+            if (include(celli)) {
                 field[celli] += nested.on_boundary(patchi, facei) / V[celli];
             }
-        }
+        });
+    }
+
+    void process_patch_faces(const microdomain& md) const {
+        for_each_patch_face(mds, md, [&](label patchi, label facei, label celli) {
+            field[celli] += nested.on_boundary(patchi, facei) / V[celli];
+        });
     }
 
-    void process_face(label facei) {
-        label own = owner[facei];
-        label nei = neighbour[facei];
-        auto face_val = nested[facei];
+    void process_boundary() const {
+        process_boundary_faces([](label) { return true; });
+    }
+
+    void process_face(label facei, label own, label nei) const {
+        auto face_val = face_value(nested, facei, own, nei);
 
         field[own] += face_val / V[own];
         field[nei] -= face_val / V[nei];
         //TODO: try moving division by V into a separate loop
     }
 
-    void process_microdomain(const microdomain& md) {
-        for (auto facei: md.internal_faces) {
-            process_face(facei);
+    void process_face(label facei, label own, label nei, bool to_own, bool to_nei) const {
+        auto face_val = face_value(nested, facei, own, nei);
+
+        if (to_own) {
+            field[own] += face_val / V[own];
+        }
+        if (to_nei) {
+            field[nei] -= face_val / V[nei];
+        }
+    }
+
+    // Owner and neighbour of the faces come from mds.compact_faces, see
+    // for_each_face_cells
+    void process_microdomain(const microdomain& md) const {
+        process_patch_faces(md);
+        auto process = [this](label facei, label own, label nei) {
+            process_face(facei, own, nei);
+        };
+        if (colouring) {
+            colouring->for_each_face_cells(md, owner, neighbour, process);
+            return;
+        }
+        for_each_face_cells(mds, md, md.internal_faces, owner, neighbour, process);
+        for_each_face_cells(mds, md, md.own_boundary_faces, owner, neighbour, process);
+    }
+
+    // Adds only contributions to cells for which include(celli) is true
+    template <typename Include>
+    void process_microdomain(const microdomain& md, const Include& include) const {
+        if (!md.cells.empty() && include(md.cells.front())) {
+            process_patch_faces(md);
+            for_each_face_cells(mds, md, md.internal_faces, owner, neighbour, [this](label facei, label own, label nei) {
+                process_face(facei, own, nei);
+            });
         }
-        for (auto facei: md.own_boundary_faces) {
-            process_face(facei);
+        for_each_face_cells(mds, md, md.own_boundary_faces, owner, neighbour, [&](label facei, label own, label nei) {
+            bool to_own = include(own);
+            bool to_nei = include(nei);
+            if (to_own || to_nei) {
+                process_face(facei, own, nei, to_own, to_nei);
+            }
+        });
+    }
+
+    // Zeroes the cells of the domains with mask[d] != 0, include(celli) is
+    // true exactly on them
+    template <typename Include>
+    void reset_cells(const std::vector<char>& mask, const Include& include) const {
+        for (size_t d = 0; d < mds.domains.size(); ++d) {
+            if (mask[d]) {
+                for (auto celli: mds.domains[d].cells) {
+                    field[celli] = Zero;
+                }
+            }
         }
+        process_boundary_faces(include);
     }
 
     const value_type operator[](Foam::label celli) const {
@@ -93,6 +161,47 @@ struct surface_integrate_expr {
 template<typename Field, typename Expr>
 struct is_expression<surface_integrate_expr<Field, Expr>> : std::true_type {};
 
+template <typename Field, typename FaceExpr>
+void process_microdomain(const surface_integrate_expr<Field, FaceExpr>& expr, const microdomain& md, int level)
+{
+    if (level == surface_integrate_expr<Field, FaceExpr>::integrate_depth) {
+        expr.process_microdomain(md);
+    }
+    else {
+        process_microdomain(expr.nested, md, level);
+    }
+}
+
+template <typename Field, typename FaceExpr>
+void process_boundary(const surface_integrate_expr<Field, FaceExpr>& expr)
+{
+    process_boundary(expr.nested);
+    expr.process_boundary();
+}
+
+template <typename Field, typename FaceExpr, typename Include>
+void process_microdomain(const surface_integrate_expr<Field, FaceExpr>& expr, const microdomain& md, int level, const Include& include)
+{
+    if (level == surface_integrate_expr<Field, FaceExpr>::integrate_depth) {
+        expr.process_microdomain(md, include);
+    }
+    else {
+        process_microdomain(expr.nested, md, level, include);
+    }
+}
+
+template <typename Field, typename FaceExpr, typename Include>
+void reset_cells(const surface_integrate_expr<Field, FaceExpr>& expr, int level,
+                 const std::vector<char>& mask, const Include& include)
+{
+    if (level == surface_integrate_expr<Field, FaceExpr>::integrate_depth) {
+        expr.reset_cells(mask, include);
+    }
+    else {
+        reset_cells(expr.nested, level, mask, include);
+    }
+}
+
 template <typename Field, typename FaceExpr, typename std::enable_if<is_expression<FaceExpr>::value, int>::type = 0>
 auto surfaceIntegrate(Field& f, const FaceExpr& arg) -> surface_integrate_expr<Field, FaceExpr> {
     return {f, arg};
@@ -101,18 +210,18 @@ auto surfaceIntegrate(Field& f, const FaceExpr& arg) -> surface_integrate_expr<F
 template <typename Field, typename Expr,
          typename std::enable_if<is_expression<Expr>::value && Expr::location == loc::face, int>::type = 0>
 auto div(Field& f, const Expr& arg) -> surface_integrate_expr<Field, Expr> {
-    return surfaceIntegrate(arg);
+    return surfaceIntegrate(f, arg);
 }
 
 template <typename Field, typename Expr,
          typename std::enable_if<is_expression<Expr>::value && Expr::location == loc::cell, int>::type = 0>
 auto div(Field& f, const Expr& arg) -> surface_integrate_expr<Field, dot_expr<field_expr<surfaceVectorField>, linear_interpolate_expr<Expr>>> {
-    return surfaceIntegrate(fve::read(arg.mesh().Sf()) & fve::interpolate(arg));
+    return surfaceIntegrate(f, fve::read(arg.mesh().Sf()) & fve::interpolate(arg));
 }
 
 template <typename Field, typename FaceExpr, typename std::enable_if<is_expression<FaceExpr>::value, int>::type = 0>
 auto gauss_grad(Field& f, const FaceExpr& arg) -> surface_integrate_expr<Field, mul_expr<field_expr<surfaceVectorField>, linear_interpolate_expr<FaceExpr>>> {
-    return surfaceIntegrate(fve::read(arg.mesh().Sf()) * fve::interpolate(arg));
+    return surfaceIntegrate(f, fve::read(arg.mesh().Sf()) * fve::interpolate(arg));
 }
 
 } // namespace fve
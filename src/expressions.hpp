@@ -13,6 +13,16 @@
 #include "surfaceMesh.H"
 #include "volMesh.H"
 
+#include "microdomains.hpp"
+#include "prefetch.hpp"
+#include "thread_pool.hpp"
+
+#include "boost/mp11/function.hpp"
+#include "boost/mp11/tuple.hpp"
+
+#include <initializer_list>
+#include <tuple>
+
 namespace Foam {
 namespace fve {
 
@@ -25,6 +35,7 @@ enum class loc {
 //    using value_type = ...;
 //    static constexpr loc location = ...;
 //    static constexpr bool has_surface_integrate = ...;
+//    static constexpr int integrate_depth = ...; // levels of nested surface integrals
 //    value_type operator[](Foam::label facei) const;
 //    value_type on_boundary(Foam::label patchi, Foam::label facei) const;
 //    void precompute_microdomain()
@@ -37,6 +48,100 @@ struct is_expression : std::false_type {};
 
 ///////////////////////////////////////////////////////////////////////////////
 
+// Generic access to subexpressions. A node keeps its children by value either
+// as `nested`, as `lhs` and `rhs`, or as a tuple `args`; other nodes are
+// leaves.
+
+template<typename, typename = void>
+struct has_nested : std::false_type {};
+
+template<typename T>
+struct has_nested<T, typename boost::mp11::mp_void<decltype(std::declval<T>().nested)> > : std::true_type {};
+
+template<typename, typename = void>
+struct has_lhs_rhs : std::false_type {};
+
+template<typename T>
+struct has_lhs_rhs<T, typename boost::mp11::mp_void<decltype(std::declval<T>().lhs), decltype(std::declval<T>().rhs)> > : std::true_type {};
+
+template<typename, typename = void>
+struct has_args : std::false_type {};
+
+template<typename T>
+struct has_args<T, typename boost::mp11::mp_void<decltype(std::declval<T>().args)> > : std::true_type {};
+
+// Calls f(child) for every direct subexpression of e
+template <typename Expr, typename Func, typename std::enable_if<has_nested<Expr>::value, int>::type = 0>
+void for_each_child(const Expr& e, Func&& f) {
+    f(e.nested);
+}
+
+template <typename Expr, typename Func, typename std::enable_if<has_lhs_rhs<Expr>::value, int>::type = 0>
+void for_each_child(const Expr& e, Func&& f) {
+    f(e.lhs);
+    f(e.rhs);
+}
+
+template <typename Expr, typename Func, typename std::enable_if<has_args<Expr>::value, int>::type = 0>
+void for_each_child(const Expr& e, Func&& f) {
+    boost::mp11::tuple_for_each(e.args, f);
+}
+
+template <typename Expr, typename Func,
+         typename std::enable_if<!has_nested<Expr>::value && !has_lhs_rhs<Expr>::value && !has_args<Expr>::value, int>::type = 0>
+void for_each_child(const Expr& e, Func&& f) {
+    // leaf
+}
+
+constexpr int max_depth(std::initializer_list<int> depths) {
+    int result = 0;
+    for (int d: depths) {
+        if (d > result) {
+            result = d;
+        }
+    }
+    return result;
+}
+
+// Prefetches the values expression e reads to compute its element i. Nodes
+// gathering values from other elements overload this, all other nodes pass
+// it to their children.
+template <typename Expr>
+void prefetch_element(const Expr& e, Foam::label i) {
+    for_each_child(e, [&](const auto& child) {
+        prefetch_element(child, i);
+    });
+}
+
+// Value of face expression e at internal face facei, whose owner and
+// neighbour the caller already knows (see microdomains::compact_faces). Nodes
+// interpolating from cells overload this to use own and nei instead of
+// reading owner and neighbour, operators pass it to their operands, all other
+// nodes are evaluated by index.
+template <typename Expr>
+auto face_value(const Expr& e, Foam::label facei, Foam::label own, Foam::label nei) -> typename Expr::value_type {
+    return e[facei];
+}
+
+// Calls func(i) for all i in [begin, end). With prefetching switched on,
+// values needed by e for element i + prefetch_distance() are prefetched.
+template <typename Expression, typename Func>
+void for_each_element(const Expression& e, Foam::label begin, Foam::label end, Func&& func) {
+    const Foam::label distance = prefetch_distance();
+    Foam::label i = begin;
+    if (distance > 0) {
+        for (; i < end - distance; i++) {
+            prefetch_element(e, i + distance);
+            func(i);
+        }
+    }
+    for (; i < end; i++) {
+        func(i);
+    }
+}
+
+///////////////////////////////////////////////////////////////////////////////
+
 template<typename Field>
 struct field_expr;
 
@@ -46,6 +151,7 @@ struct field_expr<Foam::GeometricField<Type, PatchField, GeoMesh>> {
     using value_type = Type;
     static constexpr loc location = Foam::isVolMesh<GeoMesh>::value ? loc::cell : loc::face;
     static constexpr bool has_surface_integrate = false;
+    static constexpr int integrate_depth = 0;
     using field_type = Foam::GeometricField<Type, PatchField, GeoMesh>;
 
     const field_type& field;
@@ -74,6 +180,11 @@ struct field_expr<Foam::GeometricField<Type, PatchField, GeoMesh>> {
 template <typename Field>
 struct is_expression<field_expr<Field>> : std::true_type {};
 
+template <typename Field>
+void prefetch_element(const field_expr<Field>& e, Foam::label i) {
+    prefetch_object(e.field[i]);
+}
+
 template <typename Type, template<class> class PatchField, typename GeoMesh>
 auto read(const Foam::GeometricField<Type, PatchField, GeoMesh>& f) -> field_expr<Foam::GeometricField<Type, PatchField, GeoMesh>> {
     return {f};
@@ -87,6 +198,7 @@ struct linear_interpolate_expr {
     static_assert(CellExpression::location == loc::cell, "Argument ot interpolation must be cell expression");
     static constexpr loc location = loc::face;
     static constexpr bool has_surface_integrate = CellExpression::has_surface_integrate;
+    static constexpr int integrate_depth = CellExpression::integrate_depth;
 
     CellExpression nested;
     const Foam::surfaceScalarField& weight;
@@ -123,6 +235,20 @@ struct linear_interpolate_expr {
 template <typename Expr>
 struct is_expression<linear_interpolate_expr<Expr>> : std::true_type {};
 
+template <typename Expr>
+void prefetch_element(const linear_interpolate_expr<Expr>& e, Foam::label facei) {
+    prefetch_element(e.nested, e.owner[facei]);
+    prefetch_element(e.nested, e.neighbour[facei]);
+}
+
+template <typename Expr>
+auto face_value(const linear_interpolate_expr<Expr>& e, Foam::label facei, Foam::label own, Foam::label nei)
+    -> typename linear_interpolate_expr<Expr>::value_type
+{
+    auto w = e.weight[facei];
+    return w*e.nested[own] + (1-w)*e.nested[nei];
+}
+
 template <typename Expression, typename std::enable_if<is_expression<Expression>::value, int>::type = 0>
 auto interpolate(Expression e) -> linear_interpolate_expr<Expression> {
     return {e};
@@ -139,6 +265,17 @@ struct subscript {
     }
 };
 
+struct face_at {
+    Foam::label facei;
+    Foam::label own;
+    Foam::label nei;
+
+    template<typename Expr>
+    auto operator()(const Expr& e) const -> typename Expr::value_type {
+        return face_value(e, facei, own, nei);
+    }
+};
+
 struct boundary {
     Foam::label patchi;
     Foam::label facei;
@@ -167,6 +304,7 @@ struct name##_expr {                                         \
     using value_type = decltype(name(std::declval<typename Expression::value_type>())); \
     static constexpr loc location = Expression::location;    \
     static constexpr bool has_surface_integrate = Expression::has_surface_integrate; \
+    static constexpr int integrate_depth = Expression::integrate_depth; \
     Expression nested;                                       \
     name##_expr(Expression e)                                \
         : nested(e)                                          \
@@ -189,6 +327,11 @@ auto name(Expression e) -> name##_expr<Expression> {         \
     return {e};                                              \
 }                                                            \
 template <typename Expression>                               \
+auto face_value(const name##_expr<Expression>& e, Foam::label facei, Foam::label own, Foam::label nei) \
+    -> typename name##_expr<Expression>::value_type {        \
+    return name(face_value(e.nested, facei, own, nei));      \
+}                                                            \
+template <typename Expression>                               \
 struct is_expression<name##_expr<Expression>> : std::true_type {};
 
 FVE_UNARY_FUNCTION(twoSymm, transform)
@@ -213,6 +356,7 @@ struct name##_expr {                                         \
     using value_type = decltype(op std::declval<typename Expression::value_type>()); \
     static constexpr loc location = Expression::location;    \
     static constexpr bool has_surface_integrate = Expression::has_surface_integrate; \
+    static constexpr int integrate_depth = Expression::integrate_depth; \
     Expression nested;                                       \
     name##_expr(Expression e)                                \
     : nested(e)                                              \
@@ -235,6 +379,11 @@ auto operator op(Expression e) -> name##_expr<Expression> {  \
     return {e};                                              \
 }                                                            \
 template <typename Expression>                               \
+auto face_value(const name##_expr<Expression>& e, Foam::label facei, Foam::label own, Foam::label nei) \
+    -> typename name##_expr<Expression>::value_type {        \
+    return op face_value(e.nested, facei, own, nei);         \
+}                                                            \
+template <typename Expression>                               \
 struct is_expression<name##_expr<Expression>> : std::true_type {};
 
 FVE_UNARY_OPERATOR(neg, -)
@@ -248,6 +397,8 @@ struct name##_expr {
     static_assert(Expression1::location == Expression2::location, "Operands to binary expression must have the same location"); \
     static constexpr loc location = Expression1::location;                               \
     static constexpr bool has_surface_integrate = Expression1::has_surface_integrate || Expression2::has_surface_integrate; \
+    static constexpr int integrate_depth = Expression1::integrate_depth > Expression2::integrate_depth ? \
+                                           Expression1::integrate_depth : Expression2::integrate_depth; \
     Expression1 lhs;                                                                     \
     Expression2 rhs;                                                                     \
         name##_expr(Expression1 e1, Expression2 e2)                                      \
@@ -273,6 +424,11 @@ auto operator op(Expr1 e1, Expr2 e2) -> name##_expr<Expr1, Expr2> {
         return {e1, e2};                                                                 \
 }                                                                                        \
 template <typename Expr1, typename Expr2>                                                \
+auto face_value(const name##_expr<Expr1, Expr2>& e, Foam::label facei, Foam::label own, Foam::label nei) \
+    -> typename name##_expr<Expr1, Expr2>::value_type {                                  \
+    return face_value(e.lhs, facei, own, nei) op face_value(e.rhs, facei, own, nei);     \
+}                                                                                        \
+template <typename Expr1, typename Expr2>                                                \
 struct is_expression<name##_expr<Expr1, Expr2>> : std::true_type {};
 
 
@@ -286,6 +442,121 @@ FVE_BINARY_OPERATOR(dotdot, &&)
 
 ///////////////////////////////////////////////////////////////////////////////
 
+// Rewrite rules for common tensor expressions, selected by overloads more
+// specialised than the generic operators above.
+
+// (mu*dev(twoSymm(G))) & S without the intermediate symmetric tensors:
+// dev(twoSymm(G)) has off-diagonal G_ij + G_ji and diagonal 2 G_ii - 2/3 tr(G),
+// and mu scales the 3 components of S instead of the 6 of the tensor.
+inline Foam::vector dev_two_symm_dot(Foam::scalar mu, const Foam::tensor& G, const Foam::vector& S)
+{
+    const Foam::vector s = mu*S;
+    const Foam::scalar tr = (2.0/3.0)*(G.xx() + G.yy() + G.zz());
+
+    const Foam::scalar xx = 2*G.xx() - tr;
+    const Foam::scalar yy = 2*G.yy() - tr;
+    const Foam::scalar zz = 2*G.zz() - tr;
+    const Foam::scalar xy = G.xy() + G.yx();
+    const Foam::scalar xz = G.xz() + G.zx();
+    const Foam::scalar yz = G.yz() + G.zy();
+
+    return Foam::vector(
+        xx*s.x() + xy*s.y() + xz*s.z(),
+        xy*s.x() + yy*s.y() + yz*s.z(),
+        xz*s.x() + yz*s.y() + zz*s.z()
+    );
+}
+
+// Viscous flux (mu*dev(twoSymm(G))) & S, e.g. of the momentum equation
+template <typename MuExpr, typename GradExpr, typename VectorExpr>
+struct dev_two_symm_dot_expr {
+    using value_type = Foam::vector;
+    static_assert(MuExpr::location == GradExpr::location && GradExpr::location == VectorExpr::location,
+                  "Operands to binary expression must have the same location");
+    static constexpr loc location = MuExpr::location;
+    static constexpr int integrate_depth = max_depth({MuExpr::integrate_depth, GradExpr::integrate_depth, VectorExpr::integrate_depth});
+    static constexpr bool has_surface_integrate = integrate_depth > 0;
+
+    std::tuple<MuExpr, GradExpr, VectorExpr> args;
+
+    dev_two_symm_dot_expr(MuExpr mu, GradExpr grad, VectorExpr v)
+        : args(std::move(mu), std::move(grad), std::move(v))
+    {}
+
+    value_type operator [](Foam::label i) const {
+        return dev_two_symm_dot(std::get<0>(args)[i], std::get<1>(args)[i], std::get<2>(args)[i]);
+    }
+
+    value_type on_boundary(Foam::label patchi, Foam::label facei) const {
+        return dev_two_symm_dot(std::get<0>(args).on_boundary(patchi, facei),
+                                std::get<1>(args).on_boundary(patchi, facei),
+                                std::get<2>(args).on_boundary(patchi, facei));
+    }
+
+    const fvMesh& mesh() const {
+        return std::get<0>(args).mesh();
+    }
+
+    Foam::dimensionSet dimensions() const {
+        return std::get<0>(args).dimensions() * std::get<1>(args).dimensions() & std::get<2>(args).dimensions();
+    }
+};
+
+template <typename MuExpr, typename GradExpr, typename VectorExpr>
+struct is_expression<dev_two_symm_dot_expr<MuExpr, GradExpr, VectorExpr>> : std::true_type {};
+
+template <typename MuExpr, typename GradExpr, typename VectorExpr>
+Foam::vector face_value(const dev_two_symm_dot_expr<MuExpr, GradExpr, VectorExpr>& e,
+                        Foam::label facei, Foam::label own, Foam::label nei)
+{
+    return dev_two_symm_dot(face_value(std::get<0>(e.args), facei, own, nei),
+                            face_value(std::get<1>(e.args), facei, own, nei),
+                            face_value(std::get<2>(e.args), facei, own, nei));
+}
+
+template <typename MuExpr, typename GradExpr, typename VectorExpr,
+         typename std::enable_if<std::is_same<typename MuExpr::value_type, Foam::scalar>::value
+                                 && std::is_same<typename GradExpr::value_type, Foam::tensor>::value
+                                 && std::is_same<typename VectorExpr::value_type, Foam::vector>::value, int>::type = 0>
+auto operator&(mul_expr<MuExpr, dev_expr<twoSymm_expr<GradExpr>>> e1, VectorExpr e2)
+    -> dev_two_symm_dot_expr<MuExpr, GradExpr, VectorExpr>
+{
+    return {e1.lhs, e1.rhs.nested.nested, e2};
+}
+
+///////////////////////////////////////////////////////////////////////////////
+
+// Evaluates an expression without surface integrals domain by domain, calling
+// assign(i) for the cells or internal faces of a domain and then
+// assign_patch(patchi, facei) for its physical boundary faces, while the data
+// of its cells is still in cache. Faces of coupled patches are assigned at
+// the end. Groups of domains are split among threads.
+template <typename Expression, typename Assign, typename AssignPatch>
+void assign_by_microdomains(const Expression& e, const microdomains& mds, Assign&& assign, AssignPatch&& assign_patch)
+{
+    auto assign_patch_face = [&](Foam::label patchi, Foam::label facei, Foam::label) {
+        assign_patch(patchi, facei);
+    };
+
+    parallel_for(0, mds.groups.size(), [&](Foam::label begin, Foam::label end) {
+        for (Foam::label g = begin; g < end; ++g) {
+            for (auto d: mds.groups[g].domains) {
+                const microdomain& md = mds.domains[d];
+                if (Expression::location == loc::cell) {
+                    for_each_element(e, md.cells.a, md.cells.b, assign);
+                }
+                else {
+                    for_each_element(e, md.internal_faces.a, md.internal_faces.b, assign);
+                    for_each_element(e, md.own_boundary_faces.a, md.own_boundary_faces.b, assign);
+                }
+                for_each_patch_face(mds, md, assign_patch_face);
+            }
+        }
+    }, 1);
+
+    for_each_coupled_patch_face(e.mesh(), mds, assign_patch_face);
+}
+
 template <typename Type, template<class> class PatchField, typename GeoMesh, typename Expression,
          typename std::enable_if<!Expression::has_surface_integrate, int>::type = 0>
 [[gnu::noinline]]
@@ -300,21 +571,51 @@ void operator<<=(Foam::GeometricField<Type, PatchField, GeoMesh>& f, Expression
         f.dimensions() = e.dimensions();
     }
 
-    Foam::label nInternalElems = f.internalField().size();
-    for (Foam::label i = 0; i < nInternalElems; i++) {
+    auto& bf = f.boundaryFieldRef();
+    auto assign = [&](Foam::label i) {
         f[i] = e[i];
-    }
+    };
+    auto assign_patch = [&](Foam::label patchi, Foam::label facei) {
+        bf[patchi][facei] = e.on_boundary(patchi, facei);
+    };
+
+    Foam::label nInternalElems = f.internalField().size();
+    parallel_for(0, nInternalElems, [&](Foam::label begin, Foam::label end) {
+        for_each_element(e, begin, end, assign);
+    });
 
     Foam::label nPatches = mesh.boundary().size();
     for (Foam::label patchi = 0; patchi < nPatches; patchi++) {
-        PatchField<Type>& patchField = f.boundaryFieldRef()[patchi];
-        Foam::label nFaces = patchField.size();
+        Foam::label nFaces = bf[patchi].size();
 
         for (Foam::label facei = 0; facei < nFaces; facei++) {
-            patchField[facei] = e.on_boundary(patchi, facei);
+            assign_patch(patchi, facei);
         }
     }
 }
 
+// Same as f <<= e, visiting cells or faces domain by domain with the boundary
+// faces of a domain right after it (see assign_by_microdomains)
+template <typename Type, template<class> class PatchField, typename GeoMesh, typename Expression,
+         typename std::enable_if<!Expression::has_surface_integrate, int>::type = 0>
+[[gnu::noinline]]
+void assign(Foam::GeometricField<Type, PatchField, GeoMesh>& f, const microdomains& mds, Expression e)
+{
+    static_assert(Expression::location == (Foam::isVolMesh<GeoMesh>::value ? loc::cell : loc::face),
+                  "Expression must have same location (cell or face) as the target field");
+
+    if (!e.dimensions().dimensionless()) {
+        // Check dimensions
+        f.dimensions() = e.dimensions();
+    }
+
+    auto& bf = f.boundaryFieldRef();
+    assign_by_microdomains(e, mds, [&](Foam::label i) {
+        f[i] = e[i];
+    }, [&](Foam::label patchi, Foam::label facei) {
+        bf[patchi][facei] = e.on_boundary(patchi, facei);
+    });
+}
+
 } // namespace fve
 } // namespace Foam
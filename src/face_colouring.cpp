@@ -0,0 +1,102 @@
+/*
+ *
+ * Copyright: 2023 Ilya Popov <ilya.popov@isteq.nl>, ISTEQ BV
+ *
+ * SPDX-License-Identifier: GPL3.0-or-later
+ *
+ */
+
+#include "face_colouring.hpp"
+
+#include "defineDebugSwitch.H"
+
+#include <cstdlib>
+
+namespace Foam {
+namespace fve {
+
+defineTypeNameAndDebug(face_colouring, 0);
+
+} // namespace fve
+} // namespace Foam
+
+namespace {
+
+bool& enabled()
+{
+    static bool e = [] {
+        const char* s = std::getenv("FVE_COLOUR_FACES");
+        return s != nullptr && *s != '\0' && std::atol(s) != 0;
+    }();
+    return e;
+}
+
+} // namespace
+
+bool Foam::fve::colour_faces()
+{
+    return enabled();
+}
+
+void Foam::fve::set_colour_faces(bool enable)
+{
+    enabled() = enable;
+}
+
+Foam::fve::face_colouring::face_colouring(const fvMesh &mesh)
+    : Foam::MeshObject<Foam::fvMesh, Foam::GeometricMeshObject, face_colouring>(mesh)
+    , mds(microdomains::New(mesh))
+{
+    const Foam::labelUList& owner = mesh.owner();
+    const Foam::labelUList& neighbour = mesh.neighbour();
+
+    faces.reserve(mesh.nInternalFaces());
+    colour_start.push_back(0);
+    domain_colours.push_back(0);
+
+    // Colour of the last face taken that touches the cell. Colours are
+    // numbered globally, so it never has to be reset.
+    std::vector<Foam::label> taken(mesh.nCells(), -1);
+    std::vector<Foam::label> remaining;
+    std::vector<Foam::label> deferred;
+
+    // Greedy: every colour takes, in face order, all remaining faces that do
+    // not touch a cell already taken by this colour
+    for (const auto& md: mds.domains) {
+        remaining.clear();
+        for (auto facei: md.internal_faces) {
+            remaining.push_back(facei);
+        }
+        for (auto facei: md.own_boundary_faces) {
+            remaining.push_back(facei);
+        }
+
+        while (!remaining.empty()) {
+            const Foam::label c = colour_start.size() - 1;
+            deferred.clear();
+            for (auto facei: remaining) {
+                Foam::label own = owner[facei];
+                Foam::label nei = neighbour[facei];
+                if (taken[own] == c || taken[nei] == c) {
+                    deferred.push_back(facei);
+                }
+                else {
+                    taken[own] = c;
+                    taken[nei] = c;
+                    faces.push_back(facei);
+                }
+            }
+            colour_start.push_back(faces.size());
+            std::swap(remaining, deferred);
+        }
+        domain_colours.push_back(colour_start.size() - 1);
+    }
+
+    Foam::Info << "Face colours per microdomain: "
+               << (mds.domains.empty() ? 0.0 : Foam::scalar(colour_start.size() - 1) / mds.domains.size()) << "\n";
+}
+
+Foam::fve::face_colouring::~face_colouring()
+{
+
+}
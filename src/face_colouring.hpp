@@ -0,0 +1,96 @@
+/*
+ *
+ * Copyright: 2023 Ilya Popov <ilya.popov@isteq.nl>, ISTEQ BV
+ *
+ * SPDX-License-Identifier: GPL3.0-or-later
+ *
+ */
+
+#pragma once
+
+#include "microdomains.hpp"
+
+#include "fvMesh.H"
+#include "MeshObject.H"
+
+#include <vector>
+
+namespace Foam {
+namespace fve {
+
+// Faces of every microdomain (internal_faces and own_boundary_faces) split
+// into colours such that no two faces of a colour share a cell. Scatter loops
+// over one colour then have no dependencies between iterations, so they can
+// be vectorised or split between threads; the cost is a less sequential
+// access to the face data.
+struct face_colouring : public Foam::MeshObject<Foam::fvMesh, Foam::GeometricMeshObject, face_colouring> {
+    TypeName("face_colouring");
+
+    // Face indices ordered by domain, colour and index
+    std::vector<Foam::label> faces;
+
+    // Colour c is faces[colour_start[c]] ... faces[colour_start[c+1] - 1]
+    std::vector<Foam::label> colour_start;
+
+    // Colours of domain d are domain_colours[d] ... domain_colours[d+1] - 1
+    std::vector<Foam::label> domain_colours;
+
+    explicit face_colouring(const Foam::fvMesh& mesh);
+    virtual ~face_colouring();
+
+    index_range colours(const microdomain& md) const {
+        domain_label d = mds.cell_dist[md.cells.front()];
+        return {domain_colours[d], domain_colours[d + 1]};
+    }
+
+    index_range colour_faces(Foam::label c) const {
+        return {colour_start[c], colour_start[c + 1]};
+    }
+
+    // Calls func(facei) for all faces of md, colour by colour
+    template <typename Func>
+    void for_each_face(const microdomain& md, const Func& func) const {
+        if (md.cells.empty()) {
+            return;
+        }
+        const Foam::label* f = faces.data();
+        for (auto c: colours(md)) {
+            const index_range r = colour_faces(c);
+            #pragma GCC ivdep
+            for (Foam::label i = r.a; i < r.b; ++i) {
+                func(f[i]);
+            }
+        }
+    }
+
+    // Same, calling func(facei, own, nei) with owner and neighbour of the face,
+    // taken from mds.compact_faces if it is set
+    template <typename Func>
+    void for_each_face_cells(const microdomain& md, const Foam::labelUList& owner, const Foam::labelUList& neighbour,
+                             const Func& func) const {
+        if (mds.compact_faces.empty()) {
+            for_each_face(md, [&](Foam::label facei) {
+                func(facei, owner[facei], neighbour[facei]);
+            });
+            return;
+        }
+        const Foam::label base = md.cells.a;
+        const compact_face* cf = mds.compact_faces.data();
+        for_each_face(md, [&](Foam::label facei) {
+            func(facei, base + cf[facei].own, base + cf[facei].nei);
+        });
+    }
+
+private:
+    const microdomains& mds;
+};
+
+// Whether surface integrals scatter face contributions colour by colour
+// (see face_colouring) instead of in face order. Off by default, the initial
+// value is taken from FVE_COLOUR_FACES environment variable.
+bool colour_faces();
+
+void set_colour_faces(bool enable);
+
+} //namespace fve
+} //namespace Foam
@@ -0,0 +1,53 @@
+/*
+ *
+ * Copyright: 2023 Ilya Popov <ilya.popov@isteq.nl>, ISTEQ BV
+ *
+ * SPDX-License-Identifier: GPL3.0-or-later
+ *
+ */
+
+#include "face_geometry.hpp"
+
+#include "surfaceFields.H"
+#include "defineDebugSwitch.H"
+
+namespace Foam {
+namespace fve {
+
+defineTypeNameAndDebug(face_geometry, 0);
+
+} // namespace fve
+} // namespace Foam
+
+Foam::fve::face_geometry::face_geometry(const fvMesh &mesh)
+    : Foam::MeshObject<Foam::fvMesh, Foam::GeometricMeshObject, face_geometry>(mesh)
+{
+    const Foam::labelUList& owner = mesh.owner();
+    const Foam::labelUList& neighbour = mesh.neighbour();
+    const Foam::surfaceScalarField& weights = mesh.weights();
+    const Foam::surfaceVectorField& Sf = mesh.Sf();
+
+    faces.resize(mesh.nInternalFaces());
+    for (Foam::label facei = 0; facei < mesh.nInternalFaces(); facei++) {
+        faces[facei] = packed_face{owner[facei], neighbour[facei], weights[facei], Sf[facei]};
+    }
+}
+
+Foam::fve::face_geometry::~face_geometry()
+{
+
+}
+
+const std::vector<Foam::fve::packed_face_metrics>& Foam::fve::face_geometry::metrics() const
+{
+    if (metrics_.empty() && !faces.empty()) {
+        const Foam::surfaceScalarField& magSf = mesh_.magSf();
+        const Foam::surfaceScalarField& deltaCoeffs = mesh_.deltaCoeffs();
+
+        metrics_.resize(faces.size());
+        for (size_t facei = 0; facei < faces.size(); facei++) {
+            metrics_[facei] = packed_face_metrics{magSf[facei], deltaCoeffs[facei]};
+        }
+    }
+    return metrics_;
+}
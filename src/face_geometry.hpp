@@ -0,0 +1,51 @@
+/*
+ *
+ * Copyright: 2023 Ilya Popov <ilya.popov@isteq.nl>, ISTEQ BV
+ *
+ * SPDX-License-Identifier: GPL3.0-or-later
+ *
+ */
+
+#pragma once
+
+#include "fvMesh.H"
+#include "MeshObject.H"
+
+#include <vector>
+
+namespace Foam {
+namespace fve {
+
+// Everything linear interpolation and flux computation need for an internal
+// face, so that one stream replaces owner, neighbour, weights and Sf arrays.
+struct packed_face {
+    Foam::label owner;
+    Foam::label neighbour;
+    Foam::scalar weight;
+    Foam::vector Sf;
+};
+
+// Less frequently used face data, kept out of packed_face to keep it small
+struct packed_face_metrics {
+    Foam::scalar magSf;
+    Foam::scalar delta_coeff;
+};
+
+struct face_geometry : public Foam::MeshObject<Foam::fvMesh, Foam::GeometricMeshObject, face_geometry> {
+    TypeName("face_geometry");
+
+    // Internal faces only
+    std::vector<packed_face> faces;
+
+    explicit face_geometry(const Foam::fvMesh& mesh);
+    virtual ~face_geometry();
+
+    // Built on first use
+    const std::vector<packed_face_metrics>& metrics() const;
+
+private:
+    mutable std::vector<packed_face_metrics> metrics_;
+};
+
+} //namespace fve
+} //namespace Foam
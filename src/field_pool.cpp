@@ -0,0 +1,49 @@
+/*
+ *
+ * Copyright: 2023 Ilya Popov <ilya.popov@isteq.nl>, ISTEQ BV
+ *
+ * SPDX-License-Identifier: GPL3.0-or-later
+ *
+ */
+
+#include "field_pool.hpp"
+
+#include "defineDebugSwitch.H"
+
+namespace Foam {
+namespace fve {
+
+defineTypeNameAndDebug(field_pool, 0);
+
+} // namespace fve
+} // namespace Foam
+
+Foam::fve::field_pool::field_pool(const fvMesh &mesh)
+    : Foam::MeshObject<Foam::fvMesh, Foam::UpdateableMeshObject, field_pool>(mesh)
+{}
+
+Foam::fve::field_pool::~field_pool()
+{
+    if (outstanding != 0) {
+        Foam::FatalError << "Field pool destroyed with " << outstanding
+                         << " fields still in use" << Foam::abort(Foam::FatalError);
+    }
+}
+
+bool Foam::fve::field_pool::movePoints()
+{
+    return true;
+}
+
+void Foam::fve::field_pool::updateMesh(const Foam::mapPolyMesh&)
+{
+    available.clear();
+    topology++;
+}
+
+void Foam::fve::field_pool::report(Ostream& os) const
+{
+    os << "Field pool: " << counters.acquired << " fields acquired, "
+       << counters.allocated << " allocated, "
+       << label(counters.allocated_bytes >> 20) << " MiB" << nl;
+}
@@ -0,0 +1,149 @@
+/*
+ *
+ * Copyright: 2023 Ilya Popov <ilya.popov@isteq.nl>, ISTEQ BV
+ *
+ * SPDX-License-Identifier: GPL3.0-or-later
+ *
+ */
+
+#pragma once
+
+#include "fvMesh.H"
+#include "MeshObject.H"
+#include "mapPolyMesh.H"
+#include "GeometricField.H"
+
+#include <map>
+#include <memory>
+#include <typeindex>
+#include <vector>
+
+namespace Foam {
+namespace fve {
+
+class field_pool;
+
+// Field borrowed from a field_pool, returned to it on destruction. Contents
+// are whatever the previous user left there. Must not outlive the pool, which
+// lives as long as the mesh.
+template <typename GeoField>
+class pooled_field {
+public:
+    pooled_field(const field_pool& pool, GeoField* field, Foam::label topology)
+        : pool(&pool)
+        , field(field)
+        , topology(topology)
+    {}
+
+    pooled_field(pooled_field&& other)
+        : pool(other.pool)
+        , field(other.field)
+        , topology(other.topology)
+    {
+        other.field = nullptr;
+    }
+
+    pooled_field(const pooled_field&) = delete;
+    pooled_field& operator=(const pooled_field&) = delete;
+
+    ~pooled_field();
+
+    GeoField& ref() { return *field; }
+    const GeoField& operator()() const { return *field; }
+    GeoField& operator()() { return *field; }
+
+private:
+    const field_pool* pool;
+    GeoField* field;
+    // Topology of the mesh the field was sized for, see field_pool::release
+    Foam::label topology;
+};
+
+// Per-mesh pool of full-mesh fields used as temporaries. Fields are created
+// once, touched to fault their pages in, and handed out again after release,
+// so steady state time steps do not allocate. Kept on mesh motion; after
+// topology changes the free fields are dropped, and fields handed out before
+// are deleted when released instead of being reused.
+class field_pool : public Foam::MeshObject<Foam::fvMesh, Foam::UpdateableMeshObject, field_pool> {
+public:
+    TypeName("field_pool");
+
+    struct statistics {
+        Foam::label acquired = 0;
+        Foam::label allocated = 0;
+        size_t allocated_bytes = 0;
+    };
+
+    explicit field_pool(const Foam::fvMesh& mesh);
+
+    // Aborts if fields are still handed out
+    virtual ~field_pool();
+
+    // Fields do not depend on the points
+    virtual bool movePoints();
+
+    // Drops the free fields, they have the size of the old mesh
+    virtual void updateMesh(const Foam::mapPolyMesh& mpm);
+
+    template <typename GeoField>
+    pooled_field<GeoField> acquire(const Foam::dimensionSet& dims) const
+    {
+        using Type = typename GeoField::value_type;
+
+        counters.acquired++;
+        outstanding++;
+
+        auto& free_fields = available[std::type_index(typeid(GeoField))];
+        if (!free_fields.empty()) {
+            GeoField* f = static_cast<GeoField*>(free_fields.back().release());
+            free_fields.pop_back();
+            f->dimensions().reset(dims);
+            return pooled_field<GeoField>(*this, f, topology);
+        }
+
+        GeoField* f = new GeoField(
+            Foam::IOobject("fvePool" + Foam::name(counters.allocated), mesh_.time().timeName(), mesh_,
+                           Foam::IOobject::NO_READ, Foam::IOobject::NO_WRITE, false),
+            mesh_,
+            Foam::dimensioned<Type>(dims, Foam::Zero));
+
+        counters.allocated++;
+        counters.allocated_bytes += f->size() * sizeof(Type);
+        return pooled_field<GeoField>(*this, f, topology);
+    }
+
+    // Takes back a field acquired while the mesh had the given topology
+    template <typename GeoField>
+    void release(GeoField* f, Foam::label field_topology) const
+    {
+        outstanding--;
+        if (field_topology != topology) {
+            delete f;
+            return;
+        }
+        available[std::type_index(typeid(GeoField))].emplace_back(f);
+    }
+
+    const statistics& stats() const { return counters; }
+
+    void report(Foam::Ostream& os) const;
+
+private:
+    mutable std::map<std::type_index, std::vector<std::unique_ptr<Foam::regIOobject>>> available;
+    mutable statistics counters;
+    // Fields handed out and not released yet
+    mutable Foam::label outstanding = 0;
+    // Number of topology changes seen
+    Foam::label topology = 0;
+};
+
+template <typename GeoField>
+pooled_field<GeoField>::~pooled_field()
+{
+    if (field) {
+        pool->release(field, topology);
+    }
+}
+
+} //namespace fve
+} //namespace Foam
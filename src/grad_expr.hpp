@@ -9,6 +9,7 @@
 #pragma once
 
 #include "expressions.hpp"
+#include "hex_stencils.hpp"
 
 #include "leastSquaresVectors.H"
 
@@ -21,6 +22,7 @@ struct grad_expr {
     static_assert(CellExpr::location == loc::cell, "Argument to gradient must be cell expression");
     static constexpr loc location = loc::cell;
     static constexpr bool has_surface_integrate = false;
+    static constexpr int integrate_depth = CellExpr::integrate_depth;
 
     CellExpr nested;
     const Foam::leastSquaresVectors& lsv;
@@ -29,6 +31,8 @@ struct grad_expr {
     const Foam::cellList& cells;
     const Foam::surfaceVectorField& pVectors;
     const Foam::surfaceVectorField& nVectors;
+    // Set if cells with 6 faces take the fixed size path
+    const hex_stencils* hex;
 
     grad_expr(const CellExpr& arg)
         : nested(arg)
@@ -38,9 +42,28 @@ struct grad_expr {
         , cells(arg.mesh().cells())
         , pVectors(lsv.pVectors())
         , nVectors(lsv.nVectors())
+        , hex(hex_fast_path() ? &hex_stencils::New(arg.mesh()) : nullptr)
     {}
 
+    template <int NFaces>
+    value_type gradient(const fixed_cell_stencil<NFaces>& s, Foam::label celli) const {
+        value_type grad{};
+        auto val = nested[celli];
+
+        for (int i = 0; i < NFaces; i++) {
+            grad += s.d[i] * (nested[celli + s.offset[i]] - val);
+        }
+
+        return grad;
+    }
+
     value_type operator [](Foam::label celli) const {
+        if (hex) {
+            if (const hex_stencil* s = hex->find(celli)) {
+                return gradient(*s, celli);
+            }
+        }
+
         const Foam::cell &cell = cells[celli];
 
         value_type grad{};
@@ -83,6 +106,25 @@ struct grad_expr {
 template<typename Expr>
 struct is_expression<grad_expr<Expr>> : std::true_type {};
 
+template <typename Expr>
+void prefetch_element(const grad_expr<Expr>& e, Foam::label celli) {
+    if (e.hex) {
+        if (const hex_stencil* s = e.hex->find(celli)) {
+            prefetch_object(*s);
+            for (int i = 0; i < hex_stencil::n_faces; i++) {
+                prefetch_element(e.nested, celli + s->offset[i]);
+            }
+            return;
+        }
+    }
+    for (Foam::label facei: e.cells[celli]) {
+        if (facei < e.owner.size()) {
+            prefetch_element(e.nested, e.owner[facei]);
+            prefetch_element(e.nested, e.neighbour[facei]);
+        }
+    }
+}
+
 template <typename CellExpr, typename std::enable_if<is_expression<CellExpr>::value, int>::type = 0>
 auto grad(const CellExpr& arg) -> grad_expr<CellExpr> {
     return {arg};
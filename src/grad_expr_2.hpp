@@ -11,6 +11,7 @@
 #include "expressions.hpp"
 
 #include "microdomains.hpp"
+#include "face_colouring.hpp"
 
 #include "process_microdomains.hpp"
 
@@ -25,6 +26,7 @@ struct grad_expr_2 {
     static_assert(CellExpr::location == loc::cell, "Argument to gradient must be cell expression");
     static constexpr loc location = loc::cell;
     static constexpr bool has_surface_integrate = true;
+    static constexpr int integrate_depth = CellExpr::integrate_depth + 1;
 
     Field& field;
     CellExpr nested;
@@ -34,6 +36,9 @@ struct grad_expr_2 {
     const Foam::cellList& cells;
     const Foam::surfaceVectorField& pVectors;
     const Foam::surfaceVectorField& nVectors;
+    const microdomains& mds;
+    // Set if faces are processed colour by colour, see face_colouring.hpp
+    const face_colouring* colouring;
 
     grad_expr_2(Field& f, const CellExpr& arg)
         : field(f)
@@ -44,6 +49,8 @@ struct grad_expr_2 {
         , cells(arg.mesh().cells())
         , pVectors(lsv.pVectors())
         , nVectors(lsv.nVectors())
+        , mds(microdomains::New(arg.mesh()))
+        , colouring(colour_faces() ? &face_colouring::New(arg.mesh()) : nullptr)
     {}
 
     value_type operator[](Foam::label celli) const {
@@ -54,29 +61,69 @@ struct grad_expr_2 {
         return field.boundaryField()[patchi][facei];
     }
 
-    void process_face(Foam::label facei) const {
-        auto own = owner[facei];
-        auto nei = neighbour[facei];
+    void process_face(Foam::label facei, Foam::label own, Foam::label nei) const {
         auto delta_v = nested[nei] - nested[own];
         field[own] += pVectors[facei] * delta_v;
         field[nei] -= nVectors[facei] * delta_v;
     }
 
+    void process_face(Foam::label facei, Foam::label own, Foam::label nei, bool to_own, bool to_nei) const {
+        auto delta_v = nested[nei] - nested[own];
+        if (to_own) {
+            field[own] += pVectors[facei] * delta_v;
+        }
+        if (to_nei) {
+            field[nei] -= nVectors[facei] * delta_v;
+        }
+    }
+
     void process_microdomain(const microdomain& md) const {
         //std::cout << "Processing microdomain " << md.internal_faces << " + " << md.own_boundary_faces << std::endl;
-        for (Foam::label facei: md.internal_faces) {
-            process_face(facei);
+        auto process = [this](Foam::label facei, Foam::label own, Foam::label nei) {
+            process_face(facei, own, nei);
+        };
+        if (colouring) {
+            colouring->for_each_face_cells(md, owner, neighbour, process);
+            return;
         }
+        for_each_face_cells(mds, md, md.internal_faces, owner, neighbour, process);
+        for_each_face_cells(mds, md, md.own_boundary_faces, owner, neighbour, process);
+    }
 
-        for (Foam::label facei: md.own_boundary_faces) {
-            process_face(facei);
+    // Adds only contributions to cells for which include(celli) is true
+    template <typename Include>
+    void process_microdomain(const microdomain& md, const Include& include) const {
+        if (!md.cells.empty() && include(md.cells.front())) {
+            for_each_face_cells(mds, md, md.internal_faces, owner, neighbour,
+                                [this](Foam::label facei, Foam::label own, Foam::label nei) {
+                process_face(facei, own, nei);
+            });
         }
+        for_each_face_cells(mds, md, md.own_boundary_faces, owner, neighbour,
+                            [&](Foam::label facei, Foam::label own, Foam::label nei) {
+            bool to_own = include(own);
+            bool to_nei = include(nei);
+            if (to_own || to_nei) {
+                process_face(facei, own, nei, to_own, to_nei);
+            }
+        });
     }
 
     void process_boundary() const {
         // TODO:
     }
 
+    // Zeroes the cells of the domains with mask[d] != 0
+    void reset_cells(const std::vector<char>& mask) const {
+        for (size_t d = 0; d < mds.domains.size(); ++d) {
+            if (mask[d]) {
+                for (auto celli: mds.domains[d].cells) {
+                    field[celli] = Foam::Zero;
+                }
+            }
+        }
+    }
+
     const fvMesh& mesh() const {
         return nested.mesh();
     }
@@ -97,9 +144,44 @@ auto grad(Field& f, const CellExpr& arg) -> grad_expr_2<Field, CellExpr> {
 }
 
 template <typename Field, typename CellExpr>
-void process_microdomain(const grad_expr_2<Field, CellExpr>& expr, const microdomain& md)
+void process_microdomain(const grad_expr_2<Field, CellExpr>& expr, const microdomain& md, int level)
 {
-    expr.process_microdomain(md);
+    if (level == grad_expr_2<Field, CellExpr>::integrate_depth) {
+        expr.process_microdomain(md);
+    }
+    else {
+        process_microdomain(expr.nested, md, level);
+    }
+}
+
+template <typename Field, typename CellExpr>
+void process_boundary(const grad_expr_2<Field, CellExpr>& expr)
+{
+    process_boundary(expr.nested);
+    expr.process_boundary();
+}
+
+template <typename Field, typename CellExpr, typename Include>
+void process_microdomain(const grad_expr_2<Field, CellExpr>& expr, const microdomain& md, int level, const Include& include)
+{
+    if (level == grad_expr_2<Field, CellExpr>::integrate_depth) {
+        expr.process_microdomain(md, include);
+    }
+    else {
+        process_microdomain(expr.nested, md, level, include);
+    }
+}
+
+template <typename Field, typename CellExpr, typename Include>
+void reset_cells(const grad_expr_2<Field, CellExpr>& expr, int level,
+                 const std::vector<char>& mask, const Include& include)
+{
+    if (level == grad_expr_2<Field, CellExpr>::integrate_depth) {
+        expr.reset_cells(mask);
+    }
+    else {
+        reset_cells(expr.nested, level, mask, include);
+    }
 }
 
 } // namespace fve
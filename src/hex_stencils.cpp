@@ -0,0 +1,97 @@
+/*
+ *
+ * Copyright: 2023 Ilya Popov <ilya.popov@isteq.nl>, ISTEQ BV
+ *
+ * SPDX-License-Identifier: GPL3.0-or-later
+ *
+ */
+
+#include "hex_stencils.hpp"
+
+#include "leastSquaresVectors.H"
+#include "defineDebugSwitch.H"
+
+#include <cstdlib>
+#include <limits>
+
+namespace Foam {
+namespace fve {
+
+defineTypeNameAndDebug(hex_stencils, 0);
+
+} // namespace fve
+} // namespace Foam
+
+namespace {
+
+bool& enabled()
+{
+    static bool e = [] {
+        const char* s = std::getenv("FVE_HEX_FAST_PATH");
+        return s == nullptr || *s == '\0' || std::atol(s) != 0;
+    }();
+    return e;
+}
+
+} // namespace
+
+bool Foam::fve::hex_fast_path()
+{
+    return enabled();
+}
+
+void Foam::fve::set_hex_fast_path(bool enable)
+{
+    enabled() = enable;
+}
+
+Foam::fve::hex_stencils::hex_stencils(const fvMesh &mesh)
+    : Foam::MeshObject<Foam::fvMesh, Foam::GeometricMeshObject, hex_stencils>(mesh)
+{
+    const Foam::leastSquaresVectors& lsv = Foam::leastSquaresVectors::New(mesh);
+    const Foam::surfaceVectorField& pVectors = lsv.pVectors();
+    const Foam::surfaceVectorField& nVectors = lsv.nVectors();
+    const Foam::labelUList& owner = mesh.owner();
+    const Foam::labelUList& neighbour = mesh.neighbour();
+    const Foam::cellList& cells = mesh.cells();
+
+    stencil_of.assign(mesh.nCells(), -1);
+
+    for (Foam::label celli = 0; celli < mesh.nCells(); celli++) {
+        const Foam::cell& c = cells[celli];
+        if (c.size() != hex_stencil::n_faces) {
+            continue;
+        }
+
+        hex_stencil s;
+        bool fits = true;
+        for (int i = 0; i < hex_stencil::n_faces; i++) {
+            const Foam::label facei = c[i];
+            s.offset[i] = 0;
+            s.d[i] = Foam::vector::zero;
+            if (facei < mesh.nInternalFaces()) {
+                const Foam::label own = owner[facei];
+                const Foam::label nei = neighbour[facei];
+                const Foam::label other = own == celli ? nei : own;
+                if (std::abs(other - celli) > std::numeric_limits<std::int32_t>::max()) {
+                    fits = false;
+                    break;
+                }
+                s.offset[i] = other - celli;
+                s.d[i] = own == celli ? pVectors[facei] : nVectors[facei];
+            }
+        }
+
+        if (fits) {
+            stencil_of[celli] = stencils.size();
+            stencils.push_back(s);
+        }
+    }
+
+    Foam::Info << "Cells with hex stencils: " << stencils.size() << " of " << mesh.nCells() << "\n";
+}
+
+Foam::fve::hex_stencils::~hex_stencils()
+{
+
+}
@@ -0,0 +1,62 @@
+/*
+ *
+ * Copyright: 2023 Ilya Popov <ilya.popov@isteq.nl>, ISTEQ BV
+ *
+ * SPDX-License-Identifier: GPL3.0-or-later
+ *
+ */
+
+#pragma once
+
+#include "fvMesh.H"
+#include "MeshObject.H"
+
+#include <cstdint>
+#include <vector>
+
+namespace Foam {
+namespace fve {
+
+// Least squares gradient stencil of a cell with a fixed number of faces:
+// offsets of the neighbour cells relative to the cell itself and the least
+// squares vectors (pVectors or nVectors, depending on which side of the face
+// the cell is on). A face on a physical boundary has offset 0 and a zero
+// vector, so it contributes nothing, like in the generic path.
+template <int NFaces>
+struct fixed_cell_stencil {
+    static constexpr int n_faces = NFaces;
+
+    std::int32_t offset[NFaces];
+    Foam::vector d[NFaces];
+};
+
+using hex_stencil = fixed_cell_stencil<6>;
+
+// Stencils of all cells with 6 faces, which in hex dominant meshes are most
+// of them. Kernels for such cells loop over a fixed number of faces and read
+// one contiguous record instead of the cell's face list, owner, neighbour and
+// least squares vectors of every face.
+struct hex_stencils : public Foam::MeshObject<Foam::fvMesh, Foam::GeometricMeshObject, hex_stencils> {
+    TypeName("hex_stencils");
+
+    // Index into stencils for each cell, -1 for cells using the generic path
+    std::vector<Foam::label> stencil_of;
+    std::vector<hex_stencil> stencils;
+
+    explicit hex_stencils(const Foam::fvMesh& mesh);
+    virtual ~hex_stencils();
+
+    const hex_stencil* find(Foam::label celli) const {
+        const Foam::label i = stencil_of[celli];
+        return i < 0 ? nullptr : &stencils[i];
+    }
+};
+
+// Whether gradient kernels use hex_stencils for cells with 6 faces. On by
+// default, FVE_HEX_FAST_PATH=0 switches it off.
+bool hex_fast_path();
+
+void set_hex_fast_path(bool enable);
+
+} //namespace fve
+} //namespace Foam
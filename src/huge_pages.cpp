@@ -0,0 +1,292 @@
+/*
+ *
+ * Copyright: 2023 Ilya Popov <ilya.popov@isteq.nl>, ISTEQ BV
+ *
+ * SPDX-License-Identifier: GPL3.0-or-later
+ *
+ */
+
+#include "huge_pages.hpp"
+
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <mutex>
+
+#include <dirent.h>
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#ifndef MAP_HUGE_SHIFT
+#define MAP_HUGE_SHIFT 26
+#endif
+#ifndef MAP_HUGE_2MB
+#define MAP_HUGE_2MB (21 << MAP_HUGE_SHIFT)
+#endif
+#ifndef MAP_HUGE_1GB
+#define MAP_HUGE_1GB (30 << MAP_HUGE_SHIFT)
+#endif
+
+namespace {
+
+constexpr std::size_t page_2m = std::size_t(1) << 21;
+constexpr std::size_t page_1g = std::size_t(1) << 30;
+
+// Mappings made by huge_page_allocate, so that operator delete can tell
+// them from malloc blocks. A fixed table: operator new cannot use containers
+// that allocate. Allocations are not mapped when it is full.
+struct mapping {
+    std::uintptr_t base;
+    std::size_t length;
+};
+
+constexpr int max_mappings = 4096;
+
+std::mutex table_mutex;
+mapping table[max_mappings];
+int n_mappings = 0;
+std::atomic<int> n_mappings_hint{0};
+
+std::atomic<std::uint64_t> fallbacks{0};
+
+// Reports the first fallback from hugetlb to transparent pages. Does not
+// allocate, it may be called from operator new.
+void report_fallback(std::size_t page)
+{
+    if (fallbacks.fetch_add(1, std::memory_order_relaxed) == 0) {
+        const char* message = page == page_1g
+            ? "fve: no free 1GB huge pages, using transparent huge pages (further fallbacks are counted)\n"
+            : "fve: no free 2MB huge pages, using transparent huge pages (further fallbacks are counted)\n";
+        std::fputs(message, stderr);
+    }
+}
+
+std::size_t round_up(std::size_t n, std::size_t alignment)
+{
+    return (n + alignment - 1)/alignment*alignment;
+}
+
+Foam::fve::huge_page_mode env_mode()
+{
+    const char* s = std::getenv("FVE_HUGE_PAGES");
+    if (s == nullptr || *s == '\0') {
+        return Foam::fve::huge_page_mode::off;
+    }
+    if (std::strcmp(s, "thp") == 0 || std::strcmp(s, "transparent") == 0 || std::strcmp(s, "1") == 0) {
+        return Foam::fve::huge_page_mode::transparent;
+    }
+    if (std::strcmp(s, "2M") == 0) {
+        return Foam::fve::huge_page_mode::hugetlb_2m;
+    }
+    if (std::strcmp(s, "1G") == 0) {
+        return Foam::fve::huge_page_mode::hugetlb_1g;
+    }
+    return Foam::fve::huge_page_mode::off;
+}
+
+std::atomic<int>& mode()
+{
+    static std::atomic<int> m{static_cast<int>(env_mode())};
+    return m;
+}
+
+// Anonymous mapping of length bytes aligned to 2MB, so that all of it can be
+// backed by transparent huge pages
+void* map_transparent(std::size_t length)
+{
+    const std::size_t padded = length + page_2m;
+    void* p = mmap(nullptr, padded, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (p == MAP_FAILED) {
+        return nullptr;
+    }
+
+    const std::uintptr_t start = reinterpret_cast<std::uintptr_t>(p);
+    const std::uintptr_t aligned = round_up(start, page_2m);
+    if (aligned > start) {
+        munmap(p, aligned - start);
+    }
+    const std::uintptr_t end = aligned + length;
+    if (start + padded > end) {
+        munmap(reinterpret_cast<void*>(end), start + padded - end);
+    }
+
+    void* base = reinterpret_cast<void*>(aligned);
+    madvise(base, length, MADV_HUGEPAGE);
+    return base;
+}
+
+void* map_hugetlb(std::size_t length, int size_flag)
+{
+    void* p = mmap(nullptr, length, PROT_READ | PROT_WRITE,
+                   MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB | size_flag, -1, 0);
+    return p == MAP_FAILED ? nullptr : p;
+}
+
+long perf_event_open(perf_event_attr* attr, pid_t tid)
+{
+    return syscall(__NR_perf_event_open, attr, tid, -1, -1, 0);
+}
+
+} // namespace
+
+Foam::fve::huge_page_mode Foam::fve::huge_pages()
+{
+    return static_cast<huge_page_mode>(mode().load(std::memory_order_relaxed));
+}
+
+void Foam::fve::set_huge_pages(huge_page_mode m)
+{
+    mode().store(static_cast<int>(m), std::memory_order_relaxed);
+}
+
+const char* Foam::fve::huge_page_mode_name(huge_page_mode m)
+{
+    switch (m) {
+    case huge_page_mode::off:
+        return "off";
+    case huge_page_mode::transparent:
+        return "transparent";
+    case huge_page_mode::hugetlb_2m:
+        return "hugetlb 2MB";
+    case huge_page_mode::hugetlb_1g:
+        return "hugetlb 1GB";
+    }
+    return "unknown";
+}
+
+void* Foam::fve::huge_page_allocate(std::size_t size)
+{
+    const huge_page_mode m = huge_pages();
+    if (m == huge_page_mode::off || size < huge_page_min_size) {
+        return nullptr;
+    }
+
+    std::lock_guard<std::mutex> lock(table_mutex);
+    if (n_mappings == max_mappings) {
+        return nullptr;
+    }
+
+    void* base = nullptr;
+    std::size_t length = 0;
+
+    if (m == huge_page_mode::hugetlb_1g && size >= page_1g) {
+        length = round_up(size, page_1g);
+        base = map_hugetlb(length, MAP_HUGE_1GB);
+        if (base == nullptr) {
+            report_fallback(page_1g);
+        }
+    }
+    else if (m == huge_page_mode::hugetlb_1g || m == huge_page_mode::hugetlb_2m) {
+        // 1GB pages only for allocations of at least 1GB, smaller ones would
+        // waste most of a page
+        length = round_up(size, page_2m);
+        base = map_hugetlb(length, MAP_HUGE_2MB);
+        if (base == nullptr) {
+            report_fallback(page_2m);
+        }
+    }
+
+    if (base == nullptr) {
+        length = round_up(size, page_2m);
+        base = map_transparent(length);
+    }
+
+    if (base == nullptr) {
+        return nullptr;
+    }
+
+    table[n_mappings++] = mapping{reinterpret_cast<std::uintptr_t>(base), length};
+    n_mappings_hint.store(n_mappings, std::memory_order_relaxed);
+    return base;
+}
+
+bool Foam::fve::huge_page_free(void* p)
+{
+    const std::uintptr_t address = reinterpret_cast<std::uintptr_t>(p);
+    if (p == nullptr || address % page_2m != 0 || n_mappings_hint.load(std::memory_order_relaxed) == 0) {
+        return false;
+    }
+
+    std::lock_guard<std::mutex> lock(table_mutex);
+    for (int i = 0; i < n_mappings; i++) {
+        if (table[i].base == address) {
+            munmap(p, table[i].length);
+            table[i] = table[--n_mappings];
+            n_mappings_hint.store(n_mappings, std::memory_order_relaxed);
+            return true;
+        }
+    }
+    return false;
+}
+
+std::uint64_t Foam::fve::huge_page_fallbacks()
+{
+    return fallbacks.load(std::memory_order_relaxed);
+}
+
+Foam::fve::dtlb_counter::dtlb_counter()
+{
+    perf_event_attr attr;
+    std::memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = PERF_TYPE_HW_CACHE;
+    attr.config = PERF_COUNT_HW_CACHE_DTLB
+                | (PERF_COUNT_HW_CACHE_OP_READ << 8)
+                | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+    attr.disabled = 1;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+
+    DIR* tasks = opendir("/proc/self/task");
+    if (tasks == nullptr) {
+        return;
+    }
+    while (dirent* entry = readdir(tasks)) {
+        if (entry->d_name[0] == '.') {
+            continue;
+        }
+        int fd = static_cast<int>(perf_event_open(&attr, static_cast<pid_t>(std::atol(entry->d_name))));
+        if (fd < 0) {
+            // Count all threads or none
+            for (int f: fds) {
+                close(f);
+            }
+            fds.clear();
+            break;
+        }
+        fds.push_back(fd);
+    }
+    closedir(tasks);
+}
+
+Foam::fve::dtlb_counter::~dtlb_counter()
+{
+    for (int fd: fds) {
+        close(fd);
+    }
+}
+
+void Foam::fve::dtlb_counter::start()
+{
+    for (int fd: fds) {
+        ioctl(fd, PERF_EVENT_IOC_RESET, 0);
+        ioctl(fd, PERF_EVENT_IOC_ENABLE, 0);
+    }
+}
+
+std::uint64_t Foam::fve::dtlb_counter::stop()
+{
+    std::uint64_t total = 0;
+    for (int fd: fds) {
+        ioctl(fd, PERF_EVENT_IOC_DISABLE, 0);
+        std::uint64_t count = 0;
+        if (read(fd, &count, sizeof(count)) == sizeof(count)) {
+            total += count;
+        }
+    }
+    return total;
+}
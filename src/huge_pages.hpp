@@ -0,0 +1,99 @@
+/*
+ *
+ * Copyright: 2023 Ilya Popov <ilya.popov@isteq.nl>, ISTEQ BV
+ *
+ * SPDX-License-Identifier: GPL3.0-or-later
+ *
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace Foam {
+namespace fve {
+
+// Backing of large allocations (fields, mesh addressing) with huge pages,
+// to cut TLB misses of neighbour gathers over multi-GB arrays.
+//
+// Allocations of at least huge_page_min_size bytes made through global
+// operator new (which Foam::List uses) get their own 2MB aligned mapping:
+//  - transparent: anonymous mapping with madvise(MADV_HUGEPAGE), needs
+//    /sys/kernel/mm/transparent_hugepage/enabled set to madvise or always
+//  - hugetlb_2m, hugetlb_1g: MAP_HUGETLB mapping from the reserved pool
+//    (vm.nr_hugepages or hugepages-1048576kB). With hugetlb_1g only
+//    allocations of at least 1GB use 1GB pages, smaller ones 2MB pages.
+//    Falls back to transparent huge pages when the pool is exhausted; the
+//    first fallback is reported on stderr, all are counted
+// The mode applies to allocations made after it is set, so it has to be set
+// before the mesh and fields are read. The initial value is taken from
+// FVE_HUGE_PAGES environment variable: off (default), thp, 2M or 1G.
+enum class huge_page_mode {
+    off,
+    transparent,
+    hugetlb_2m,
+    hugetlb_1g
+};
+
+constexpr std::size_t huge_page_min_size = std::size_t(2) << 20;
+
+huge_page_mode huge_pages();
+
+void set_huge_pages(huge_page_mode mode);
+
+const char* huge_page_mode_name(huge_page_mode mode);
+
+// Used by the global operator new and delete in alloc_counter.cpp.
+// huge_page_allocate returns nullptr if the mode is off or the allocation is
+// small, then the caller allocates as usual. huge_page_free returns false if
+// p was not allocated by huge_page_allocate.
+void* huge_page_allocate(std::size_t size);
+
+bool huge_page_free(void* p);
+
+// Number of allocations that did not get hugetlb pages and fell back to
+// transparent huge pages
+std::uint64_t huge_page_fallbacks();
+
+// Counts data TLB load misses of all threads of the process that exist when
+// it is created (including thread_pool workers) with perf_event_open.
+// available() is false if the counters cannot be opened, e.g. with
+// kernel.perf_event_paranoid > 2 or in a VM without a PMU.
+class dtlb_counter {
+public:
+    dtlb_counter();
+    ~dtlb_counter();
+
+    dtlb_counter(const dtlb_counter&) = delete;
+    dtlb_counter& operator=(const dtlb_counter&) = delete;
+
+    bool available() const { return !fds.empty(); }
+
+    void start();
+    std::uint64_t stop();
+
+private:
+    std::vector<int> fds;
+};
+
+// Runs op the given number of times and returns its dTLB load misses per
+// iteration, or -1 if the counter is not available
+template <typename Op>
+double dtlb_misses(Op&& op, int iterations = 3)
+{
+    dtlb_counter counter;
+    if (!counter.available()) {
+        return -1;
+    }
+
+    counter.start();
+    for (int i = 0; i < iterations; i++) {
+        op();
+    }
+    return static_cast<double>(counter.stop())/iterations;
+}
+
+} // namespace fve
+} // namespace Foam
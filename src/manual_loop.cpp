@@ -8,53 +8,190 @@
 
 #include "manual_loop.hpp"
 
-void Foam::compute_viscous_flux(surfaceVectorField &F_rhoU, const volTensorField &gradU, const volScalarField &mu)
+#include "face_geometry.hpp"
+#include "microdomains.hpp"
+
+namespace {
+
+void compute_viscous_flux_patch_face(Foam::surfaceVectorField &F_rhoU, const Foam::volTensorField &gradU, const Foam::volScalarField &mu,
+                                     Foam::label patchi, Foam::label facei)
 {
+    using namespace Foam;
+
+    const fvPatchTensorField& p_gradU = gradU.boundaryField()[patchi];
+    const fvsPatchVectorField& p_Sf = gradU.mesh().Sf().boundaryField()[patchi];
+    const fvPatchScalarField& p_mu = mu.boundaryField()[patchi];
+
+    F_rhoU.boundaryFieldRef()[patchi][facei] = (p_mu[facei] * dev(twoSymm(p_gradU[facei]))) & p_Sf[facei];
+}
+
+void compute_viscous_flux_coupled_patch(Foam::surfaceVectorField &F_rhoU, const Foam::volTensorField &gradU, const Foam::volScalarField &mu,
+                                        Foam::label patchi)
+{
+    using namespace Foam;
+
     const fvMesh& mesh = gradU.mesh();
-    const surfaceVectorField& Sf = mesh.Sf();
-    const labelUList& owner = mesh.owner();
-    const labelUList& neighbour = mesh.neighbour();
-    const surfaceScalarField& weights = mesh.weights();
+    const fvsPatchVectorField& p_Sf = mesh.Sf().boundaryField()[patchi];
+    const fvsPatchScalarField& p_w = mesh.weights().boundaryField()[patchi];
+    const fvPatchTensorField& p_gradU = gradU.boundaryField()[patchi];
+    const fvPatchScalarField& p_mu = mu.boundaryField()[patchi];
+    fvsPatchVectorField& p_F_rhoU = F_rhoU.boundaryFieldRef()[patchi];
 
-    for (label facei = 0; facei < mesh.nInternalFaces(); facei++) {
-        label own = owner[facei];
-        label nei = neighbour[facei];
-        scalar w = weights[facei];
+    auto p_mu_internal = p_mu.patchInternalField();
+    auto p_mu_neighbour = p_mu.patchNeighbourField();
+    auto p_gradU_internal = p_gradU.patchInternalField();
+    auto p_gradU_neighbour = p_gradU.patchNeighbourField();
 
-        scalar mu_f    = w*mu[own]    + (1.0-w)*mu[nei];
-        tensor gradU_f = w*gradU[own] + (1.0-w)*gradU[nei];
-        F_rhoU[facei] = (mu_f * dev(twoSymm(gradU_f))) & Sf[facei];
+    label nFaces = p_F_rhoU.size();
+    for (label facei = 0; facei < nFaces; facei++) {
+        scalar w = p_w[facei];
+        scalar mu_f    = w*p_mu_internal()[facei]    + (1.0-w)*p_mu_neighbour()[facei];
+        tensor gradU_f = w*p_gradU_internal()[facei] + (1.0-w)*p_gradU_neighbour()[facei];
+        p_F_rhoU[facei] = (mu_f * dev(twoSymm(gradU_f))) & p_Sf[facei];
     }
+}
+
+void compute_viscous_flux_boundary(Foam::surfaceVectorField &F_rhoU, const Foam::volTensorField &gradU, const Foam::volScalarField &mu)
+{
+    using namespace Foam;
+
+    const fvMesh& mesh = gradU.mesh();
 
     for (label patchi = 0; patchi < mesh.boundary().size(); patchi++) {
         const fvPatch& patch = mesh.boundary()[patchi];
-        const fvPatchTensorField& p_gradU = gradU.boundaryField()[patchi];
-        const fvsPatchVectorField& p_Sf = Sf.boundaryField()[patchi];
-        const fvPatchScalarField& p_mu = mu.boundaryField()[patchi];
-        fvsPatchVectorField& p_F_rhoU = F_rhoU.boundaryFieldRef()[patchi];
 
         if (!patch.coupled()) {
             label nFaces = patch.size();
             for (label facei = 0; facei < nFaces; facei++) {
-                p_F_rhoU[facei] = (p_mu[facei] * dev(twoSymm(p_gradU[facei]))) & p_Sf[facei];
+                compute_viscous_flux_patch_face(F_rhoU, gradU, mu, patchi, facei);
             }
         }
         else {
-            auto p_mu_internal = p_mu.patchInternalField();
-            auto p_mu_neighbour = p_mu.patchNeighbourField();
-            auto p_gradU_internal = p_gradU.patchInternalField();
-            auto p_gradU_neighbour = p_gradU.patchNeighbourField();
-            const fvsPatchScalarField& p_w = weights.boundaryField()[patchi];
+            compute_viscous_flux_coupled_patch(F_rhoU, gradU, mu, patchi);
+        }
+    }
+}
 
-            label nFaces = patch.size();
-            for (label facei = 0; facei < nFaces; facei++) {
-                scalar w = p_w[facei];
-                scalar mu_f    = w*p_mu_internal()[facei]    + (1.0-w)*p_mu_neighbour()[facei];
-                tensor gradU_f = w*p_gradU_internal()[facei] + (1.0-w)*p_gradU_neighbour()[facei];
-                p_F_rhoU[facei] = (mu_f * dev(twoSymm(gradU_f))) & p_Sf[facei];
-            }
+// Calls internal_face(facei) for all internal faces in face order and then
+// computes boundary fluxes
+template <typename InternalFace>
+void for_each_viscous_flux_face(Foam::surfaceVectorField &F_rhoU, const Foam::volTensorField &gradU, const Foam::volScalarField &mu,
+                                InternalFace&& internal_face)
+{
+    using namespace Foam;
+
+    const fvMesh& mesh = gradU.mesh();
+
+    for (label facei = 0; facei < mesh.nInternalFaces(); facei++) {
+        internal_face(facei);
+    }
+    compute_viscous_flux_boundary(F_rhoU, gradU, mu);
+}
+
+// Same, visiting faces domain by domain and the physical boundary faces of a
+// domain right after its internal faces, while the data of its cells is still
+// in cache; coupled patches come last
+template <typename InternalFace>
+void for_each_viscous_flux_face(Foam::surfaceVectorField &F_rhoU, const Foam::volTensorField &gradU, const Foam::volScalarField &mu,
+                                const Foam::fve::microdomains& mds, InternalFace&& internal_face)
+{
+    using namespace Foam;
+
+    for (const auto& md: mds.domains) {
+        for (auto facei: md.internal_faces) {
+            internal_face(facei);
+        }
+        for (auto facei: md.own_boundary_faces) {
+            internal_face(facei);
         }
+        fve::for_each_patch_face(mds, md, [&](label patchi, label facei, label) {
+            compute_viscous_flux_patch_face(F_rhoU, gradU, mu, patchi, facei);
+        });
+    }
+    for (auto patchi: mds.coupled_patches) {
+        compute_viscous_flux_coupled_patch(F_rhoU, gradU, mu, patchi);
+    }
+}
+
+// Viscous flux of one internal face, reading geometry from the mesh
+struct viscous_flux_face {
+    Foam::surfaceVectorField& F_rhoU;
+    const Foam::volTensorField& gradU;
+    const Foam::volScalarField& mu;
+    const Foam::surfaceVectorField& Sf;
+    const Foam::labelUList& owner;
+    const Foam::labelUList& neighbour;
+    const Foam::surfaceScalarField& weights;
+
+    viscous_flux_face(Foam::surfaceVectorField& F_rhoU, const Foam::volTensorField& gradU, const Foam::volScalarField& mu)
+        : F_rhoU(F_rhoU)
+        , gradU(gradU)
+        , mu(mu)
+        , Sf(gradU.mesh().Sf())
+        , owner(gradU.mesh().owner())
+        , neighbour(gradU.mesh().neighbour())
+        , weights(gradU.mesh().weights())
+    {}
+
+    void operator()(Foam::label facei) const {
+        using namespace Foam;
+
+        label own = owner[facei];
+        label nei = neighbour[facei];
+        scalar w = weights[facei];
+
+        scalar mu_f    = w*mu[own]    + (1.0-w)*mu[nei];
+        tensor gradU_f = w*gradU[own] + (1.0-w)*gradU[nei];
+        F_rhoU[facei] = (mu_f * dev(twoSymm(gradU_f))) & Sf[facei];
     }
+};
+
+// Same, reading geometry from packed face records
+struct viscous_flux_packed_face {
+    Foam::surfaceVectorField& F_rhoU;
+    const Foam::volTensorField& gradU;
+    const Foam::volScalarField& mu;
+    const std::vector<Foam::fve::packed_face>& faces;
+
+    viscous_flux_packed_face(Foam::surfaceVectorField& F_rhoU, const Foam::volTensorField& gradU, const Foam::volScalarField& mu)
+        : F_rhoU(F_rhoU)
+        , gradU(gradU)
+        , mu(mu)
+        , faces(Foam::fve::face_geometry::New(gradU.mesh()).faces)
+    {}
+
+    void operator()(Foam::label facei) const {
+        using namespace Foam;
+
+        const fve::packed_face& f = faces[facei];
+        scalar w = f.weight;
+
+        scalar mu_f    = w*mu[f.owner]    + (1.0-w)*mu[f.neighbour];
+        tensor gradU_f = w*gradU[f.owner] + (1.0-w)*gradU[f.neighbour];
+        F_rhoU[facei] = (mu_f * dev(twoSymm(gradU_f))) & f.Sf;
+    }
+};
+
+} // namespace
+
+void Foam::compute_viscous_flux(surfaceVectorField &F_rhoU, const volTensorField &gradU, const volScalarField &mu)
+{
+    for_each_viscous_flux_face(F_rhoU, gradU, mu, viscous_flux_face(F_rhoU, gradU, mu));
+}
+
+void Foam::compute_viscous_flux(surfaceVectorField &F_rhoU, const volTensorField &gradU, const volScalarField &mu,
+                                const fve::microdomains& mds)
+{
+    for_each_viscous_flux_face(F_rhoU, gradU, mu, mds, viscous_flux_face(F_rhoU, gradU, mu));
 }
 
+void Foam::compute_viscous_flux_packed(surfaceVectorField &F_rhoU, const volTensorField &gradU, const volScalarField &mu)
+{
+    for_each_viscous_flux_face(F_rhoU, gradU, mu, viscous_flux_packed_face(F_rhoU, gradU, mu));
+}
 
+void Foam::compute_viscous_flux_packed(surfaceVectorField &F_rhoU, const volTensorField &gradU, const volScalarField &mu,
+                                       const fve::microdomains& mds)
+{
+    for_each_viscous_flux_face(F_rhoU, gradU, mu, mds, viscous_flux_packed_face(F_rhoU, gradU, mu));
+}
@@ -14,6 +14,22 @@
 
 namespace Foam {
 
+namespace fve {
+struct microdomains;
+}
+
+// Internal faces are visited in face order
 void compute_viscous_flux(surfaceVectorField & F_rhoU, const volTensorField& gradU, const volScalarField & mu);
 
+// Same, visiting faces domain by domain, with the physical boundary faces of a
+// domain right after its internal faces
+void compute_viscous_flux(surfaceVectorField & F_rhoU, const volTensorField& gradU, const volScalarField & mu,
+                          const fve::microdomains& mds);
+
+// Same, reading internal face geometry from packed face records
+void compute_viscous_flux_packed(surfaceVectorField & F_rhoU, const volTensorField& gradU, const volScalarField & mu);
+
+void compute_viscous_flux_packed(surfaceVectorField & F_rhoU, const volTensorField& gradU, const volScalarField & mu,
+                                 const fve::microdomains& mds);
+
 } // namespace Foam
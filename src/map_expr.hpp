@@ -23,14 +23,15 @@ struct map_expr {
     static constexpr bool all_args_surf = boost::mp11::mp_all_of<boost::mp11::mp_list<Args...>, is_surface_expr>::value;
     static_assert(all_args_vol || all_args_surf, "All arguments to map expr must be the same location, either all cell or all face.");
     static constexpr loc location = all_args_vol? loc::cell : loc::face;
-    static constexpr bool has_surface_integrate = false; //FIXME
+    static constexpr int integrate_depth = max_depth({Args::integrate_depth...});
+    static constexpr bool has_surface_integrate = integrate_depth > 0;
 
     Func func;
-    std::tuple<Args&...> args;
+    std::tuple<Args...> args;
 
-    map_expr(Func&& func, Args&&... args)
-        : func(std::forward<Func>(func))
-        , args(std::forward_as_tuple(args...))
+    map_expr(Func func, Args... args)
+        : func(std::move(func))
+        , args(std::move(args)...)
     {}
 
     value_type operator [](Foam::label i) const {
@@ -52,8 +53,20 @@ struct map_expr {
 };
 
 template <typename Func, typename... Args>
-auto map(Func&& func, Args&&... args) -> map_expr<Func, Args...> {
-    return {std::forward<Func>(func), std::forward<Args>(args)...};
+struct is_expression<map_expr<Func, Args...>> : std::true_type {};
+
+template <typename Func, typename... Args>
+auto face_value(const map_expr<Func, Args...>& e, Foam::label facei, Foam::label own, Foam::label nei)
+    -> typename map_expr<Func, Args...>::value_type
+{
+    return boost::mp11::tuple_apply(e.func, boost::mp11::tuple_transform(face_at{facei, own, nei}, e.args));
+}
+
+// Arguments are stored by value, like in all other expression nodes
+template <typename Func, typename... Args,
+         typename std::enable_if<boost::mp11::mp_all_of<boost::mp11::mp_list<Args...>, is_expression>::value, int>::type = 0>
+auto map(Func func, Args... args) -> map_expr<Func, Args...> {
+    return {std::move(func), std::move(args)...};
 }
 
 } // namespace fve
@@ -0,0 +1,34 @@
+/*
+ *
+ * Copyright: 2023 Ilya Popov <ilya.popov@isteq.nl>, ISTEQ BV
+ *
+ * SPDX-License-Identifier: GPL3.0-or-later
+ *
+ */
+
+#include "memo_expr.hpp"
+
+#include "defineDebugSwitch.H"
+
+namespace Foam {
+namespace fve {
+
+defineTypeNameAndDebug(memo_cache, 0);
+
+} // namespace fve
+} // namespace Foam
+
+Foam::fve::memo_cache::memo_cache(const fvMesh &mesh)
+    : Foam::MeshObject<Foam::fvMesh, Foam::GeometricMeshObject, memo_cache>(mesh)
+{
+}
+
+Foam::fve::memo_cache::~memo_cache()
+{
+
+}
+
+void Foam::fve::memo_cache::clear() const
+{
+    entries.clear();
+}
@@ -0,0 +1,202 @@
+/*
+ *
+ * Copyright: 2023 Ilya Popov <ilya.popov@isteq.nl>, ISTEQ BV
+ *
+ * SPDX-License-Identifier: GPL3.0-or-later
+ *
+ */
+
+#pragma once
+
+#include "expressions.hpp"
+#include "change_tracker.hpp"
+
+#include "fvMesh.H"
+#include "MeshObject.H"
+
+#include <map>
+#include <memory>
+#include <typeindex>
+#include <utility>
+#include <vector>
+
+namespace Foam {
+namespace fve {
+
+// State of a field read by a memoised expression at the time its values were
+// cached. GeometricField::primitiveFieldRef(), boundaryFieldRef() and ref()
+// (and so OpenFOAM operators, <<= and update()) advance eventNo; writing
+// through operator[] alone does not, such changes are not seen.
+struct field_version {
+    const Foam::regIOobject* field;
+    Foam::label event_no;
+    Foam::label time_index;
+
+    bool operator==(const field_version& other) const {
+        return field == other.field && event_no == other.event_no && time_index == other.time_index;
+    }
+};
+
+// Collects versions of the fields an expression reads. Sets cacheable to
+// false if it reads anything whose changes cannot be detected.
+template <typename Expr>
+void collect_versions(const Expr& e, std::vector<field_version>& versions, bool& cacheable) {
+    for_each_child(e, [&](const auto& child) {
+        collect_versions(child, versions, cacheable);
+    });
+}
+
+template <typename Field>
+void collect_versions(const field_expr<Field>& e, std::vector<field_version>& versions, bool& cacheable) {
+    cacheable = false;
+}
+
+template <typename Type, template<class> class PatchField, typename GeoMesh>
+void collect_versions(const field_expr<Foam::GeometricField<Type, PatchField, GeoMesh>>& e,
+                      std::vector<field_version>& versions, bool& cacheable) {
+    versions.push_back(field_version{&e.field, e.field.eventNo(), e.field.timeIndex()});
+}
+
+struct memo_entry_base {
+    virtual ~memo_entry_base() = default;
+};
+
+// Values of a memoised expression, with the versions of its inputs
+template <typename Type>
+struct memo_entry : memo_entry_base {
+    std::vector<Type> internal;
+    std::vector<std::vector<Type>> boundary;
+    std::vector<field_version> versions;
+};
+
+// Cached values of memoised expressions of a mesh, keyed by the type of the
+// expression and the addresses of the fields it reads. Dropped when points
+// move or the topology changes.
+struct memo_cache : public Foam::MeshObject<Foam::fvMesh, Foam::GeometricMeshObject, memo_cache> {
+    TypeName("memo_cache");
+
+    using key = std::pair<std::type_index, std::vector<const void*>>;
+
+    explicit memo_cache(const Foam::fvMesh& mesh);
+    virtual ~memo_cache();
+
+    // Forgets all cached values
+    void clear() const;
+
+    mutable std::map<key, std::unique_ptr<memo_entry_base>> entries;
+};
+
+// Evaluates an expression once and serves its values from a cache in later
+// evaluations, as long as none of the fields it reads changed (eventNo or
+// timeIndex) and the mesh is not changing. Meant for time invariant parts,
+// e.g. memo(interpolate(read(mu))) with constant viscosity.
+//
+// Two memoised expressions of the same type reading the same fields share
+// their values, so values captured by map() functions or other constants
+// inside must not change between evaluations. Expressions with surface
+// integrals cannot be memoised.
+template<typename Expression>
+struct memo_expr {
+    using value_type = typename Expression::value_type;
+    static_assert(!Expression::has_surface_integrate, "Expressions with surface integrals cannot be memoised");
+    static constexpr loc location = Expression::location;
+    static constexpr bool has_surface_integrate = false;
+    static constexpr int integrate_depth = 0;
+
+    // Not named nested: for traversals this node is a leaf, its values are
+    // already computed
+    Expression inner;
+    const memo_entry<value_type>* entry;
+
+    memo_expr(Expression e)
+        : inner(e)
+        , entry(&lookup_or_evaluate(e))
+    {}
+
+    value_type operator [](Foam::label i) const {
+        return entry->internal[i];
+    }
+
+    value_type on_boundary(Foam::label patchi, Foam::label facei) const {
+        return entry->boundary[patchi][facei];
+    }
+
+    const fvMesh& mesh() const {
+        return inner.mesh();
+    }
+
+    Foam::dimensionSet dimensions() const {
+        return inner.dimensions();
+    }
+
+private:
+    static const memo_entry<value_type>& lookup_or_evaluate(const Expression& e) {
+        const fvMesh& mesh = e.mesh();
+        const memo_cache& cache = memo_cache::New(mesh);
+
+        std::vector<const void*> inputs;
+        collect_inputs(e, inputs);
+
+        std::vector<field_version> versions;
+        bool cacheable = true;
+        collect_versions(e, versions, cacheable);
+
+        auto& slot = cache.entries[memo_cache::key(std::type_index(typeid(Expression)), inputs)];
+        if (!slot) {
+            slot.reset(new memo_entry<value_type>());
+        }
+        auto& entry = static_cast<memo_entry<value_type>&>(*slot);
+
+        const Foam::label n = location == loc::cell ? mesh.nCells() : mesh.nInternalFaces();
+        if (cacheable && !mesh.changing() && entry.versions == versions
+            && static_cast<Foam::label>(entry.internal.size()) == n) {
+            return entry;
+        }
+
+        entry.internal.resize(n);
+        parallel_for(0, n, [&](Foam::label begin, Foam::label end) {
+            for_each_element(e, begin, end, [&](Foam::label i) {
+                entry.internal[i] = e[i];
+            });
+        });
+
+        entry.boundary.resize(mesh.boundary().size());
+        for (Foam::label patchi = 0; patchi < mesh.boundary().size(); patchi++) {
+            Foam::label nFaces = mesh.boundary()[patchi].size();
+            entry.boundary[patchi].resize(nFaces);
+            for (Foam::label facei = 0; facei < nFaces; facei++) {
+                entry.boundary[patchi][facei] = e.on_boundary(patchi, facei);
+            }
+        }
+
+        entry.versions = std::move(versions);
+        return entry;
+    }
+};
+
+template <typename Expr>
+struct is_expression<memo_expr<Expr>> : std::true_type {};
+
+template <typename Expr>
+void prefetch_element(const memo_expr<Expr>& e, Foam::label i) {
+    prefetch_object(e.entry->internal[i]);
+}
+
+// update() must see the fields the memoised expression reads
+template <typename Expr>
+void collect_inputs(const memo_expr<Expr>& e, std::vector<const void*>& inputs) {
+    collect_inputs(e.inner, inputs);
+}
+
+template <typename Expr>
+void collect_versions(const memo_expr<Expr>& e, std::vector<field_version>& versions, bool& cacheable) {
+    collect_versions(e.inner, versions, cacheable);
+}
+
+template <typename Expression, typename std::enable_if<is_expression<Expression>::value, int>::type = 0>
+auto memo(Expression e) -> memo_expr<Expression> {
+    return {e};
+}
+
+} // namespace fve
+} // namespace Foam
@@ -0,0 +1,348 @@
+/*
+ *
+ * Copyright: 2023 Ilya Popov <ilya.popov@isteq.nl>, ISTEQ BV
+ *
+ * SPDX-License-Identifier: GPL3.0-or-later
+ *
+ */
+
+#include "mesh_dump.hpp"
+
+#include "volFields.H"
+#include "polyPatch.H"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <string>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace {
+
+constexpr char dump_magic[8] = {'F', 'V', 'E', 'D', 'U', 'M', 'P', '1'};
+constexpr std::size_t name_size = 64;
+
+// All records are multiples of 8 bytes and every block is padded to 8 bytes,
+// so arrays in the mapped file are properly aligned.
+
+struct dump_header {
+    char magic[8];
+    std::uint64_t label_size;
+    std::uint64_t scalar_size;
+    std::uint64_t n_points;
+    std::uint64_t n_faces;
+    std::uint64_t n_internal_faces;
+    std::uint64_t n_face_points;
+    std::uint64_t n_patches;
+    std::uint64_t n_fields;
+};
+
+struct dump_patch {
+    char name[name_size];
+    char type[name_size];
+    std::uint64_t start;
+    std::uint64_t size;
+};
+
+// Followed by n_patches patch field type names and n_values field values
+// (internal field, then all patches in order)
+struct dump_field {
+    char name[name_size];
+    char type[name_size];
+    char instance[name_size];
+    double dimensions[Foam::dimensionSet::nDimensions];
+    std::uint64_t n_values;
+};
+
+void copy_name(char (&dst)[name_size], const std::string& src)
+{
+    if (src.size() >= name_size) {
+        Foam::FatalError << "Name " << src << " is too long for mesh dump" << Foam::abort(Foam::FatalError);
+    }
+    std::memset(dst, 0, name_size);
+    std::memcpy(dst, src.data(), src.size());
+}
+
+std::string get_name(const char* src)
+{
+    return std::string(src, strnlen(src, name_size));
+}
+
+void write_padding(std::ofstream& os, std::size_t bytes)
+{
+    static const char zeros[8] = {};
+    os.write(zeros, (8 - bytes % 8) % 8);
+}
+
+void write_block(std::ofstream& os, const void* data, std::size_t bytes)
+{
+    os.write(static_cast<const char*>(data), bytes);
+    write_padding(os, bytes);
+}
+
+struct mapped_file {
+    const char* data = nullptr;
+    std::size_t size = 0;
+
+    explicit mapped_file(const Foam::fileName& file)
+    {
+        int fd = ::open(file.c_str(), O_RDONLY);
+        if (fd < 0) {
+            Foam::FatalError << "Cannot open mesh dump " << file << Foam::abort(Foam::FatalError);
+        }
+        struct stat st;
+        if (::fstat(fd, &st) != 0) {
+            ::close(fd);
+            Foam::FatalError << "Cannot stat mesh dump " << file << Foam::abort(Foam::FatalError);
+        }
+        size = st.st_size;
+        void* p = ::mmap(nullptr, size, PROT_READ, MAP_PRIVATE | MAP_POPULATE, fd, 0);
+        ::close(fd);
+        if (p == MAP_FAILED) {
+            Foam::FatalError << "Cannot map mesh dump " << file << Foam::abort(Foam::FatalError);
+        }
+        ::madvise(p, size, MADV_SEQUENTIAL);
+        data = static_cast<const char*>(p);
+    }
+
+    ~mapped_file()
+    {
+        ::munmap(const_cast<char*>(data), size);
+    }
+
+    mapped_file(const mapped_file&) = delete;
+    mapped_file& operator=(const mapped_file&) = delete;
+};
+
+struct cursor {
+    const char* p;
+    const char* end;
+
+    const char* take(std::size_t bytes)
+    {
+        std::size_t padded = (bytes + 7) / 8 * 8;
+        if (padded > static_cast<std::size_t>(end - p)) {
+            Foam::FatalError << "Mesh dump is truncated" << Foam::abort(Foam::FatalError);
+        }
+        const char* result = p;
+        p += padded;
+        return result;
+    }
+
+    template <typename T>
+    const T* take(std::size_t n)
+    {
+        return reinterpret_cast<const T*>(take(n * sizeof(T)));
+    }
+};
+
+template <typename Type>
+using vol_field = Foam::GeometricField<Type, Foam::fvPatchField, Foam::volMesh>;
+
+template <typename Type>
+bool write_field(std::ofstream& os, const Foam::fvMesh& mesh, const Foam::word& name)
+{
+    if (!mesh.foundObject<vol_field<Type>>(name)) {
+        return false;
+    }
+    const auto& f = mesh.lookupObject<vol_field<Type>>(name);
+    const auto& bf = f.boundaryField();
+
+    dump_field h{};
+    copy_name(h.name, name);
+    copy_name(h.type, vol_field<Type>::typeName);
+    copy_name(h.instance, f.instance());
+    for (int i = 0; i < Foam::dimensionSet::nDimensions; i++) {
+        h.dimensions[i] = f.dimensions()[i];
+    }
+    h.n_values = f.size();
+    forAll(bf, patchi) {
+        h.n_values += bf[patchi].size();
+    }
+    write_block(os, &h, sizeof(h));
+
+    std::vector<char> patch_types(bf.size() * name_size, '\0');
+    forAll(bf, patchi) {
+        const std::string& type = bf[patchi].type();
+        std::memcpy(patch_types.data() + patchi * name_size, type.data(), std::min(type.size(), name_size - 1));
+    }
+    write_block(os, patch_types.data(), patch_types.size());
+
+    os.write(reinterpret_cast<const char*>(f.primitiveField().cdata()), f.size() * sizeof(Type));
+    forAll(bf, patchi) {
+        os.write(reinterpret_cast<const char*>(bf[patchi].cdata()), bf[patchi].size() * sizeof(Type));
+    }
+    write_padding(os, h.n_values * sizeof(Type));
+
+    return true;
+}
+
+template <typename Type>
+bool read_field(cursor& c, const dump_field& h, const Foam::wordList& patch_types, const Foam::fvMesh& mesh)
+{
+    if (get_name(h.type) != vol_field<Type>::typeName) {
+        return false;
+    }
+
+    auto* f = new vol_field<Type>(
+        Foam::IOobject(get_name(h.name), get_name(h.instance), mesh, Foam::IOobject::NO_READ, Foam::IOobject::NO_WRITE),
+        mesh,
+        Foam::dimensionSet(h.dimensions[0], h.dimensions[1], h.dimensions[2], h.dimensions[3],
+                           h.dimensions[4], h.dimensions[5], h.dimensions[6]),
+        patch_types);
+    auto& bf = f->boundaryFieldRef();
+
+    std::uint64_t n_values = f->size();
+    forAll(bf, patchi) {
+        n_values += bf[patchi].size();
+    }
+    if (n_values != h.n_values) {
+        Foam::FatalError << "Field " << f->name() << " in mesh dump has " << h.n_values
+                         << " values, expected " << n_values << Foam::abort(Foam::FatalError);
+    }
+
+    const Type* values = c.take<Type>(h.n_values);
+    std::memcpy(f->primitiveFieldRef().data(), values, f->size() * sizeof(Type));
+    values += f->size();
+    forAll(bf, patchi) {
+        std::memcpy(bf[patchi].data(), values, bf[patchi].size() * sizeof(Type));
+        values += bf[patchi].size();
+    }
+
+    f->store();
+    return true;
+}
+
+} // namespace
+
+void Foam::fve::write_mesh_dump(const fvMesh& mesh, const fileName& file, const wordList& field_names)
+{
+    const polyBoundaryMesh& patches = mesh.boundaryMesh();
+    const faceList& faces = mesh.faces();
+
+    labelList face_offsets(faces.size() + 1);
+    face_offsets[0] = 0;
+    forAll(faces, facei) {
+        face_offsets[facei + 1] = face_offsets[facei] + faces[facei].size();
+    }
+
+    dump_header h{};
+    std::memcpy(h.magic, dump_magic, sizeof(dump_magic));
+    h.label_size = sizeof(label);
+    h.scalar_size = sizeof(scalar);
+    h.n_points = mesh.nPoints();
+    h.n_faces = mesh.nFaces();
+    h.n_internal_faces = mesh.nInternalFaces();
+    h.n_face_points = face_offsets.last();
+    h.n_patches = patches.size();
+    h.n_fields = field_names.size();
+
+    mkDir(file.path());
+    std::ofstream os(file, std::ios::binary);
+
+    write_block(os, &h, sizeof(h));
+
+    forAll(patches, patchi) {
+        const polyPatch& pp = patches[patchi];
+        if (pp.coupled()) {
+            FatalError << "Coupled patch " << pp.name() << " is not supported by mesh dump" << abort(FatalError);
+        }
+        dump_patch p{};
+        copy_name(p.name, pp.name());
+        copy_name(p.type, pp.type());
+        p.start = pp.start();
+        p.size = pp.size();
+        write_block(os, &p, sizeof(p));
+    }
+
+    write_block(os, mesh.points().cdata(), mesh.nPoints() * sizeof(point));
+    write_block(os, face_offsets.cdata(), face_offsets.size() * sizeof(label));
+    forAll(faces, facei) {
+        os.write(reinterpret_cast<const char*>(faces[facei].cdata()), faces[facei].size() * sizeof(label));
+    }
+    write_padding(os, face_offsets.last() * sizeof(label));
+    write_block(os, mesh.faceOwner().cdata(), mesh.nFaces() * sizeof(label));
+    write_block(os, mesh.faceNeighbour().cdata(), mesh.nInternalFaces() * sizeof(label));
+
+    for (const word& name: field_names) {
+        if (!write_field<scalar>(os, mesh, name)
+         && !write_field<vector>(os, mesh, name)
+         && !write_field<tensor>(os, mesh, name)) {
+            FatalError << "Field " << name << " not found for mesh dump" << abort(FatalError);
+        }
+    }
+
+    if (!os) {
+        FatalError << "Error writing mesh dump " << file << abort(FatalError);
+    }
+}
+
+Foam::autoPtr<Foam::fvMesh> Foam::fve::read_mesh_dump(const Time& runTime, const fileName& file, bool registerObject)
+{
+    mapped_file mf(file);
+    cursor c{mf.data, mf.data + mf.size};
+
+    const dump_header& h = *c.take<dump_header>(1);
+    if (std::memcmp(h.magic, dump_magic, sizeof(dump_magic)) != 0) {
+        FatalError << file << " is not a mesh dump" << abort(FatalError);
+    }
+    if (h.label_size != sizeof(label) || h.scalar_size != sizeof(scalar)) {
+        FatalError << "Mesh dump " << file << " was written with label size " << label(h.label_size)
+                   << " and scalar size " << label(h.scalar_size) << abort(FatalError);
+    }
+
+    const dump_patch* patches = c.take<dump_patch>(h.n_patches);
+
+    pointField points(h.n_points);
+    std::memcpy(points.data(), c.take<point>(h.n_points), h.n_points * sizeof(point));
+
+    const label* face_offsets = c.take<label>(h.n_faces + 1);
+    const label* face_points = c.take<label>(h.n_face_points);
+    faceList faces(h.n_faces);
+    forAll(faces, facei) {
+        label start = face_offsets[facei];
+        label size = face_offsets[facei + 1] - start;
+        faces[facei] = face(labelUList(const_cast<label*>(face_points + start), size));
+    }
+
+    labelList owner(h.n_faces);
+    std::memcpy(owner.data(), c.take<label>(h.n_faces), h.n_faces * sizeof(label));
+    labelList neighbour(h.n_internal_faces);
+    std::memcpy(neighbour.data(), c.take<label>(h.n_internal_faces), h.n_internal_faces * sizeof(label));
+
+    autoPtr<fvMesh> meshPtr(new fvMesh(
+        IOobject(polyMesh::defaultRegion, runTime.constant(), runTime,
+                 IOobject::NO_READ, IOobject::NO_WRITE, registerObject),
+        std::move(points), std::move(faces), std::move(owner), std::move(neighbour)));
+    fvMesh& mesh = meshPtr();
+
+    polyPatchList plist(h.n_patches);
+    forAll(plist, patchi) {
+        plist.set(patchi, polyPatch::New(get_name(patches[patchi].type), get_name(patches[patchi].name),
+                                         patches[patchi].size, patches[patchi].start,
+                                         patchi, mesh.boundaryMesh()));
+    }
+    mesh.addFvPatches(plist);
+
+    for (std::uint64_t fieldi = 0; fieldi < h.n_fields; fieldi++) {
+        const dump_field& fh = *c.take<dump_field>(1);
+        const char* type_names = c.take(h.n_patches * name_size);
+        wordList patch_types(h.n_patches);
+        forAll(patch_types, patchi) {
+            patch_types[patchi] = get_name(type_names + patchi * name_size);
+        }
+        if (!read_field<scalar>(c, fh, patch_types, mesh)
+         && !read_field<vector>(c, fh, patch_types, mesh)
+         && !read_field<tensor>(c, fh, patch_types, mesh)) {
+            FatalError << "Unsupported field type " << get_name(fh.type) << " in mesh dump" << abort(FatalError);
+        }
+    }
+
+    return meshPtr;
+}
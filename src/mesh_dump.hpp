@@ -0,0 +1,35 @@
+/*
+ *
+ * Copyright: 2023 Ilya Popov <ilya.popov@isteq.nl>, ISTEQ BV
+ *
+ * SPDX-License-Identifier: GPL3.0-or-later
+ *
+ */
+
+#pragma once
+
+#include "fvMesh.H"
+#include "Time.H"
+#include "autoPtr.H"
+#include "wordList.H"
+
+namespace Foam {
+namespace fve {
+
+// Raw binary dump of the mesh (points, faces, owner, neighbour, patches) and
+// of selected vol fields. The file is memory-mapped on reading, so loading
+// costs one copy of each array instead of parsing OpenFOAM streams.
+//
+// Only serial meshes without coupled patches are supported. The dump is tied
+// to the label and scalar size it was written with.
+
+// Writes the mesh and the named vol fields (scalar, vector or tensor) found in
+// the mesh registry.
+void write_mesh_dump(const Foam::fvMesh& mesh, const Foam::fileName& file, const Foam::wordList& field_names);
+
+// Constructs the mesh from a dump. Fields contained in the dump are
+// constructed and stored in the mesh registry.
+Foam::autoPtr<Foam::fvMesh> read_mesh_dump(const Foam::Time& runTime, const Foam::fileName& file, bool registerObject = true);
+
+} // namespace fve
+} // namespace Foam
@@ -11,6 +11,9 @@
 #include "volFields.H"
 #include "defineDebugSwitch.H"
 
+#include <cstdlib>
+#include <limits>
+
 namespace Foam {
 namespace fve {
 
@@ -19,38 +22,115 @@ defineTypeNameAndDebug(microdomains, 0);
 } // namespace fve
 } // namespace Foam
 
+namespace {
+
+// Fields may already be in the registry, e.g. loaded from a mesh dump
+Foam::tmp<Foam::volScalarField> lookup_or_read(const Foam::fvMesh& mesh, const Foam::word& name, const Foam::word& instance)
+{
+    if (mesh.foundObject<Foam::volScalarField>(name)) {
+        return Foam::tmp<Foam::volScalarField>(mesh.lookupObject<Foam::volScalarField>(name));
+    }
+    return Foam::tmp<Foam::volScalarField>(
+        new Foam::volScalarField(Foam::IOobject(name, instance, mesh,
+                                                Foam::IOobject::MUST_READ, Foam::IOobject::NO_WRITE),
+                                 mesh));
+}
+
+Foam::label env_label(const char* name, Foam::label default_value)
+{
+    const char* s = std::getenv(name);
+    if (s == nullptr || *s == '\0') {
+        return default_value;
+    }
+    return std::atol(s);
+}
+
+Foam::scalar renumber_threshold()
+{
+    const char* s = std::getenv("FVE_RENUMBER_THRESHOLD");
+    if (s == nullptr || *s == '\0') {
+        return 0.2;
+    }
+    return std::atof(s);
+}
+
+// Greedy distance-2 colouring of a graph given by adjacency lists
+std::vector<std::vector<Foam::fve::domain_label>> colour_distance_2(std::vector<std::vector<Foam::fve::domain_label>>& adjacent)
+{
+    for (auto& a: adjacent) {
+        std::sort(a.begin(), a.end());
+        a.erase(std::unique(a.begin(), a.end()), a.end());
+    }
+
+    std::vector<std::vector<Foam::fve::domain_label>> colours;
+    std::vector<int> colour(adjacent.size(), -1);
+    std::vector<Foam::fve::domain_label> forbidden_by;
+    for (Foam::fve::domain_label v = 0; v < static_cast<Foam::fve::domain_label>(adjacent.size()); ++v) {
+        forbidden_by.assign(colours.size() + 1, -1);
+        for (auto n1: adjacent[v]) {
+            if (colour[n1] >= 0) {
+                forbidden_by[colour[n1]] = v;
+            }
+            for (auto n2: adjacent[n1]) {
+                if (colour[n2] >= 0) {
+                    forbidden_by[colour[n2]] = v;
+                }
+            }
+        }
+        int c = 0;
+        while (forbidden_by[c] == v) {
+            c++;
+        }
+        if (c == static_cast<int>(colours.size())) {
+            colours.emplace_back();
+        }
+        colour[v] = c;
+        colours[c].push_back(v);
+    }
+    return colours;
+}
+
+} // namespace
+
 Foam::fve::microdomains::microdomains(const fvMesh &mesh)
-    : Foam::MeshObject<Foam::fvMesh, Foam::GeometricMeshObject, microdomains>(mesh)
+    : Foam::MeshObject<Foam::fvMesh, Foam::UpdateableMeshObject, microdomains>(mesh)
 {
-    Foam::volScalarField cellDist(Foam::IOobject("cellDist", mesh.time().constant(), mesh,
-                                                 Foam::IOobject::MUST_READ, Foam::IOobject::NO_WRITE),
-                                  mesh);
-    Foam::volScalarField origCellID(Foam::IOobject("origCellID", mesh.time().timeName(), mesh,
-                                                   Foam::IOobject::MUST_READ, Foam::IOobject::NO_WRITE),
-                                    mesh);
+    Foam::tmp<Foam::volScalarField> tcellDist = lookup_or_read(mesh, "cellDist", mesh.time().constant());
+    Foam::tmp<Foam::volScalarField> torigCellID = lookup_or_read(mesh, "origCellID", mesh.time().timeName());
+    const Foam::volScalarField& cellDist = tcellDist();
+    const Foam::volScalarField& origCellID = torigCellID();
 
     cell_dist.assign(mesh.nCells(), -1);
 
     Foam::Info << "Assigning cells to microdomains...\n";
 
-    int current_domain = -1;
+    Foam::label current_domain = -1;
     for (Foam::label celli = 0; celli < mesh.nCells(); celli++) {
         Foam::label orig_celli = static_cast<Foam::label>(origCellID[celli]);
         Foam::label d = static_cast<Foam::label>(cellDist[orig_celli]);
         cell_dist[celli] = d;
         if (d != current_domain) {
             //                Foam::Info << "New microdomain " << d << " starting at cell " << celli << " origCellID " << orig_celli << "\n";
-            if (d != domains.size()) {
+            if (d != static_cast<Foam::label>(domains.size())) {
                 Foam::FatalError << "Microdomain " << d << " is out of order. Microdomains are not ordered properly" << Foam::abort(Foam::FatalError);
             }
+            if (d > std::numeric_limits<domain_label>::max()) {
+                Foam::FatalError << "Microdomain " << d << " does not fit into domain_label" << Foam::abort(Foam::FatalError);
+            }
             if (current_domain >= 0) {
                 domains[current_domain].cells.b = celli;
             }
-            domains.emplace_back(microdomain{{celli, mesh.nCells()}, {-1, -1}, {-1, -1}});
+            domains.emplace_back(microdomain{{celli, mesh.nCells()}, {-1, -1}, {-1, -1}, {0, 0}});
             current_domain = d;
         }
     }
 
+    assign_faces(mesh);
+    group(mesh);
+}
+
+void Foam::fve::microdomains::assign_faces(const fvMesh& mesh)
+{
     Foam::Info << "Assigning faces to microdomains...\n";
 
     std::vector<std::vector<Foam::label>> microdomain_internal_faces(domains.size());
@@ -80,9 +160,256 @@ Foam::fve::microdomains::microdomains(const fvMesh &mesh)
         md.internal_faces = to_range(int_faces);
         md.own_boundary_faces = to_range(microdomain_boundary_faces[d]);
     }
+
+    // Offsets of owner and neighbour from the first cell of the owner's domain
+    compact_faces.resize(mesh.nInternalFaces());
+    for (Foam::label facei = 0; facei < mesh.nInternalFaces(); facei++) {
+        const Foam::label base = domains[cell_dist[mesh.owner()[facei]]].cells.a;
+        const Foam::label nei = mesh.neighbour()[facei] - base;
+        if (nei > std::numeric_limits<std::int32_t>::max()) {
+            Foam::Info << "Face neighbours too far from their domain for 32-bit offsets, using owner and neighbour\n";
+            compact_faces.clear();
+            compact_faces.shrink_to_fit();
+            break;
+        }
+        compact_faces[facei] = compact_face{static_cast<std::int32_t>(mesh.owner()[facei] - base),
+                                            static_cast<std::int32_t>(nei)};
+    }
+
+    // Counting sort of physical boundary faces by the domain of their face cell
+    coupled_patches.clear();
+    std::vector<Foam::label> domain_start(domains.size() + 1, 0);
+    for (Foam::label patchi = 0; patchi < mesh.boundary().size(); patchi++) {
+        const Foam::fvPatch& patch = mesh.boundary()[patchi];
+        if (patch.coupled()) {
+            coupled_patches.push_back(patchi);
+            continue;
+        }
+        for (auto celli: patch.faceCells()) {
+            domain_start[cell_dist[celli] + 1]++;
+        }
+    }
+    for (size_t d = 0; d < domains.size(); ++d) {
+        domain_start[d + 1] += domain_start[d];
+        domains[d].patch_faces = {domain_start[d], domain_start[d + 1]};
+    }
+
+    patch_faces.resize(domain_start.back());
+    for (Foam::label patchi = 0; patchi < mesh.boundary().size(); patchi++) {
+        const Foam::fvPatch& patch = mesh.boundary()[patchi];
+        if (patch.coupled()) {
+            continue;
+        }
+        const Foam::labelUList& faceCells = patch.faceCells();
+        for (Foam::label facei = 0; facei < patch.size(); facei++) {
+            patch_faces[domain_start[cell_dist[faceCells[facei]]]++] = patch_face{patchi, facei, faceCells[facei]};
+        }
+    }
+}
+
+void Foam::fve::microdomains::group(const fvMesh& mesh)
+{
+    Foam::Info << "Grouping microdomains...\n";
+
+    groups.clear();
+    last_neighbour.clear();
+    neighbours.clear();
+
+    Foam::label group_cells = env_label("FVE_GROUP_CELLS", 0);
+    if (group_cells <= 0) {
+        group_cells = std::min<Foam::label>(65536, mesh.nCells() / 512);
+    }
+
+    std::vector<domain_label> group_of(domains.size());
+    for (size_t d = 0; d < domains.size(); ++d) {
+        if (groups.empty() || static_cast<Foam::label>(groups.back().cells.size()) >= group_cells) {
+            Foam::label first_cell = domains[d].cells.a;
+            groups.push_back(microdomain_group{{static_cast<Foam::label>(d), static_cast<Foam::label>(d)}, {first_cell, first_cell}, {}});
+        }
+        groups.back().domains.b = d + 1;
+        groups.back().cells.b = domains[d].cells.b;
+        group_of[d] = groups.size() - 1;
+    }
+
+    std::vector<std::vector<domain_label>> adjacent(groups.size());
+    last_neighbour.resize(domains.size());
+    neighbours.resize(domains.size());
+    for (size_t d = 0; d < domains.size(); ++d) {
+        last_neighbour[d] = d;
+        for (auto facei: domains[d].own_boundary_faces) {
+            domain_label other = cell_dist[mesh.neighbour()[facei]];
+            last_neighbour[d] = std::max(last_neighbour[d], other);
+            neighbours[d].push_back(other);
+            neighbours[other].push_back(d);
+            if (group_of[other] != group_of[d]) {
+                adjacent[group_of[d]].push_back(group_of[other]);
+                adjacent[group_of[other]].push_back(group_of[d]);
+            }
+        }
+        groups[group_of[last_neighbour[d]]].ready_domains.push_back(d);
+    }
+
+    for (auto& n: neighbours) {
+        std::sort(n.begin(), n.end());
+        n.erase(std::unique(n.begin(), n.end()), n.end());
+    }
+
+    Foam::Info << "Colouring microdomain groups...\n";
+
+    colours = colour_distance_2(adjacent);
+
+    Foam::Info << "Number of microdomains: " << domains.size() << ", groups: " << groups.size()
+               << ", colours: " << colours.size() << "\n";
+}
+
+std::vector<char> Foam::fve::expand(const microdomains& mds, const std::vector<char>& mask)
+{
+    std::vector<char> result(mask);
+    for (size_t d = 0; d < mask.size(); ++d) {
+        if (mask[d]) {
+            for (auto n: mds.neighbours[d]) {
+                result[n] = 1;
+            }
+        }
+    }
+    return result;
 }
 
 Foam::fve::microdomains::~microdomains()
 {
 
 }
+
+bool Foam::fve::microdomains::movePoints()
+{
+    return true;
+}
+
+void Foam::fve::microdomains::updateMesh(const Foam::mapPolyMesh& mpm)
+{
+    const Foam::fvMesh& mesh = mesh_;
+    const Foam::labelList& cellMap = mpm.cellMap();
+
+    Foam::label max_cells = 1;
+    for (const auto& md: domains) {
+        max_cells = std::max<Foam::label>(max_cells, md.cells.size());
+    }
+
+    Foam::Info << "Updating microdomains after topology change...\n";
+
+    // New cells inherit the domain of the cell they were made from (e.g. the
+    // parent cell in refinement), cells without one that of a neighbour
+    std::vector<domain_label> mapped(mesh.nCells(), -1);
+    for (Foam::label celli = 0; celli < mesh.nCells(); celli++) {
+        if (cellMap[celli] >= 0) {
+            mapped[celli] = cell_dist[cellMap[celli]];
+        }
+    }
+    for (bool changed = true; changed; ) {
+        changed = false;
+        for (Foam::label facei = 0; facei < mesh.nInternalFaces(); facei++) {
+            Foam::label own = mesh.owner()[facei];
+            Foam::label nei = mesh.neighbour()[facei];
+            if ((mapped[own] < 0) != (mapped[nei] < 0)) {
+                mapped[own] = mapped[nei] = std::max(mapped[own], mapped[nei]);
+                changed = true;
+            }
+        }
+    }
+
+    // Domains become runs of consecutive cells of the same old domain, so
+    // domains whose cells were scattered by the change are split. Runs
+    // grown by refinement are cut to the largest old domain size, runs
+    // shrunk below half of it by unrefinement are merged with the previous one
+    // if it has space.
+    std::vector<index_range> pieces;
+    for (Foam::label celli = 0; celli < mesh.nCells(); ) {
+        Foam::label end = celli + 1;
+        while (end < mesh.nCells() && mapped[end] == mapped[celli]) {
+            end++;
+        }
+        Foam::label n_pieces = (end - celli + max_cells - 1) / max_cells;
+        for (Foam::label p = 0; p < n_pieces; p++) {
+            index_range r{celli + (end - celli)*p/n_pieces, celli + (end - celli)*(p + 1)/n_pieces};
+            if (!pieces.empty() && 2*static_cast<Foam::label>(r.size()) < max_cells
+                && static_cast<Foam::label>(pieces.back().size() + r.size()) <= max_cells) {
+                pieces.back().b = r.b;
+            }
+            else {
+                pieces.push_back(r);
+            }
+        }
+        celli = end;
+    }
+
+    // Internal faces and own_boundary_faces of every domain must be
+    // contiguous, which topology changes usually do not preserve. Domains
+    // for which they are not are merged with the following ones until they
+    // are; the whole mesh as a single domain always qualifies.
+    const Foam::cellList& cells = mesh.cells();
+    std::vector<Foam::label> inside;
+    std::vector<Foam::label> leaving;
+    auto faces_contiguous = [&](const index_range& r) {
+        inside.clear();
+        leaving.clear();
+        for (auto celli: r) {
+            for (auto facei: cells[celli]) {
+                if (facei < mesh.nInternalFaces() && mesh.owner()[facei] == celli) {
+                    (mesh.neighbour()[facei] < r.b ? inside : leaving).push_back(facei);
+                }
+            }
+        }
+        std::sort(inside.begin(), inside.end());
+        std::sort(leaving.begin(), leaving.end());
+        return (inside.empty() || is_contiguous(inside)) && (leaving.empty() || is_contiguous(leaving));
+    };
+
+    std::vector<index_range> ranges;
+    Foam::label merged_cells = 0;
+    for (size_t i = 0; i < pieces.size(); ) {
+        index_range r = pieces[i++];
+        while (!faces_contiguous(r)) {
+            if (i == pieces.size() || static_cast<Foam::label>(r.size()) > 64*max_cells) {
+                // Give up merging piece by piece
+                r.b = mesh.nCells();
+                i = pieces.size();
+                if (!faces_contiguous(r)) {
+                    r.a = 0;
+                    ranges.clear();
+                    merged_cells = 0;
+                }
+                break;
+            }
+            r.b = pieces[i++].b;
+        }
+        if (static_cast<Foam::label>(r.size()) > max_cells) {
+            merged_cells += r.size();
+        }
+        ranges.push_back(r);
+    }
+
+    if (ranges.size() > static_cast<size_t>(std::numeric_limits<domain_label>::max())) {
+        Foam::FatalError << "Number of microdomains " << ranges.size() << " does not fit into domain_label" << Foam::abort(Foam::FatalError);
+    }
+
+    domains.clear();
+    cell_dist.assign(mesh.nCells(), -1);
+    for (size_t d = 0; d < ranges.size(); d++) {
+        domains.emplace_back(microdomain{ranges[d], {-1, -1}, {-1, -1}, {0, 0}});
+        for (auto celli: ranges[d]) {
+            cell_dist[celli] = d;
+        }
+    }
+
+    assign_faces(mesh);
+    group(mesh);
+
+    locality_loss = mesh.nCells() > 0 ? Foam::scalar(merged_cells)/mesh.nCells() : 0;
+    needs_renumbering = locality_loss > renumber_threshold();
+
+    Foam::Info << "Cells in merged microdomains: " << 100*locality_loss << "%\n";
+    if (needs_renumbering) {
+        WarningInFunction << "Locality of microdomains lost for " << 100*locality_loss
+                                << "% of cells, the mesh should be renumbered" << Foam::endl;
+    }
+}
@@ -9,35 +9,44 @@
 #pragma once
 
 #include "fvMesh.H"
+#include "mapPolyMesh.H"
 #include "MeshObject.H"
 
 #include <algorithm>
+#include <cstdint>
 #include <vector>
 
 namespace Foam {
 namespace fve {
 
+// Index of a microdomain or a group of them. Kept 32-bit also with
+// WM_LABEL_SIZE=64: domains have hundreds to thousands of cells, so even
+// meshes of billions of cells have far fewer than 2^31 of them, and per-cell
+// arrays of domain indices (cell_dist) stay half the size of label arrays.
+using domain_label = std::int32_t;
+
+// Range of cells or faces, in global (label) numbering
 struct index_range {
     struct iterator {
-        int i;
+        Foam::label i;
 
-        int operator*() const {return i;}
+        Foam::label operator*() const {return i;}
         iterator& operator++() {++i; return *this;}
         iterator operator++(int) {auto prev = *this; ++i; return prev;}
         bool operator==(const iterator& other) const {return i == other.i; }
         bool operator!=(const iterator& other) const {return i != other.i; }
     };
 
-    int a;
-    int b;
+    Foam::label a;
+    Foam::label b;
 
     iterator begin() const {return iterator{a}; }
     iterator end() const {return iterator{b}; }
     size_t size() const {return b - a; }
     bool empty() const {return a == b; }
-    int operator[](size_t i) const {return a + i; }
-    int front() const { return a; }
-    int back() const { return b-1; }
+    Foam::label operator[](size_t i) const {return a + i; }
+    Foam::label front() const { return a; }
+    Foam::label back() const { return b-1; }
 
     friend std::ostream& operator<<(std::ostream& s, const index_range& r)
     {
@@ -49,15 +58,32 @@ struct microdomain {
     index_range cells;
     index_range internal_faces;
     index_range own_boundary_faces;
+    // Range in microdomains::patch_faces
+    index_range patch_faces;
+};
+
+// Owner and neighbour of an internal face as offsets from the first cell of
+// the domain the face is assigned to. Half the size of a pair of labels with
+// WM_LABEL_SIZE=64.
+struct compact_face {
+    std::int32_t own;
+    std::int32_t nei;
+};
+
+// Face of a physical (not coupled) boundary patch, facei is local to the patch
+struct patch_face {
+    Foam::label patchi;
+    Foam::label facei;
+    Foam::label celli;
 };
 
 inline
-bool is_contiguous(const std::vector<int>& v) {
-    return std::is_sorted(v.begin(), v.end()) && v.back() - v.front() + 1 == v.size();
+bool is_contiguous(const std::vector<Foam::label>& v) {
+    return std::is_sorted(v.begin(), v.end()) && v.back() - v.front() + 1 == static_cast<Foam::label>(v.size());
 }
 
 inline
-index_range to_range(const std::vector<int>& v) {
+index_range to_range(const std::vector<Foam::label>& v) {
     if (v.empty()) {
         return {-1, -1};
     }
@@ -71,15 +97,136 @@ index_range to_range(const std::vector<int>& v) {
     return {v.front(), v.back()+1};
 }
 
-struct microdomains : public Foam::MeshObject<Foam::fvMesh, Foam::GeometricMeshObject, microdomains> {
+// Consecutive microdomains forming a larger block, e.g. sized for the last
+// level cache. Groups are the units of work distributed between threads.
+struct microdomain_group {
+    index_range domains;
+    index_range cells;
+
+    // Domains whose own_boundary_faces only reach domains up to the end of
+    // this group, i.e. can be evaluated once this group has been processed
+    std::vector<domain_label> ready_domains;
+};
+
+// Survives mesh motion unchanged. After topology changes (refinement,
+// unrefinement) domains are updated from the mapped cell_dist instead of
+// re-reading cellDist, see updateMesh.
+struct microdomains : public Foam::MeshObject<Foam::fvMesh, Foam::UpdateableMeshObject, microdomains> {
     TypeName("microdomains");
 
-    std::vector<int> cell_dist;
+    // Domain of each cell
+    std::vector<domain_label> cell_dist;
     std::vector<fve::microdomain> domains;
 
+    // Faces of physical boundary patches, assigned to the domain of their
+    // face cell so that they are evaluated in the pass over that domain.
+    // Sorted by domain, then patch and face.
+    std::vector<patch_face> patch_faces;
+
+    // Owner and neighbour of every internal face relative to cells.a of its
+    // domain, read by the face loops of surface integrals and gradients
+    // instead of mesh.owner() and neighbour(). Empty if some neighbour is
+    // further than 2^31 cells from the start of the domain, the loops then
+    // read owner() and neighbour().
+    std::vector<compact_face> compact_faces;
+
+    // Coupled (e.g. processor) patches are not assigned to domains: their
+    // values need the other side, so they are evaluated in a separate pass
+    std::vector<Foam::label> coupled_patches;
+
+    // Highest domain connected to each domain through its own_boundary_faces
+    // (the domain itself if there is none)
+    std::vector<domain_label> last_neighbour;
+
+    // Domains sharing a face with each domain, sorted
+    std::vector<std::vector<domain_label>> neighbours;
+
+    // Second level of decomposition: consecutive domains grouped into blocks
+    // of about FVE_GROUP_CELLS cells. By default there are about 512 groups
+    // (at most 65536 cells each), several per thread for up to 64 threads.
+    // The default does not depend on the number of threads, so neither do
+    // the order in which faces are added to surface integrals and the
+    // results of reductions, see reduce_expr.hpp.
+    std::vector<fve::microdomain_group> groups;
+
+    // Groups coloured so that no two groups of the same colour write to the
+    // same cell when processed, i.e. they are at least 3 steps apart in the
+    // group adjacency graph. Used to process groups from several threads.
+    std::vector<std::vector<domain_label>> colours;
+
+    // Fraction of cells in domains that had to be merged beyond the size of
+    // the original ones after topology changes, because the faces of the
+    // smaller domains were not contiguous any more. 0 for a freshly
+    // renumbered mesh.
+    Foam::scalar locality_loss = 0;
+
+    // Set when locality_loss exceeds FVE_RENUMBER_THRESHOLD (default 0.2),
+    // i.e. the mesh should be renumbered (and decomposed into microdomains)
+    // again. Renumbering itself is left to the application, the domains are
+    // rebuilt by the topology change it makes.
+    bool needs_renumbering = false;
+
     explicit microdomains(const Foam::fvMesh& mesh);
     virtual ~microdomains();
+
+    // Cells and faces do not change
+    virtual bool movePoints();
+
+    // Splits and merges domains after cells were added, removed or reordered
+    virtual void updateMesh(const Foam::mapPolyMesh& mpm);
+
+private:
+    // Face ranges and patch faces of domains from cell_dist
+    void assign_faces(const Foam::fvMesh& mesh);
+
+    // Groups, neighbours and colours of domains
+    void group(const Foam::fvMesh& mesh);
 };
 
+// Calls func(patchi, facei, celli) for the physical boundary faces of domain md
+template <typename Func>
+void for_each_patch_face(const microdomains& mds, const microdomain& md, Func&& func)
+{
+    for (auto i: md.patch_faces) {
+        const patch_face& pf = mds.patch_faces[i];
+        func(pf.patchi, pf.facei, pf.celli);
+    }
+}
+
+// Calls func(facei, own, nei) for the internal faces in range faces of domain
+// md, taking owner and neighbour from mds.compact_faces if it is set
+template <typename Func>
+void for_each_face_cells(const microdomains& mds, const microdomain& md, const index_range& faces,
+                         const Foam::labelUList& owner, const Foam::labelUList& neighbour, Func&& func)
+{
+    if (mds.compact_faces.empty()) {
+        for (auto facei: faces) {
+            func(facei, owner[facei], neighbour[facei]);
+        }
+        return;
+    }
+    const Foam::label base = md.cells.a;
+    const compact_face* f = mds.compact_faces.data();
+    for (auto facei: faces) {
+        func(facei, base + f[facei].own, base + f[facei].nei);
+    }
+}
+
+// Calls func(patchi, facei, celli) for all faces of coupled patches
+template <typename Func>
+void for_each_coupled_patch_face(const Foam::fvMesh& mesh, const microdomains& mds, Func&& func)
+{
+    for (auto patchi: mds.coupled_patches) {
+        const Foam::labelUList& faceCells = mesh.boundary()[patchi].faceCells();
+        Foam::label nFaces = faceCells.size();
+        for (Foam::label facei = 0; facei < nFaces; facei++) {
+            func(patchi, facei, faceCells[facei]);
+        }
+    }
+}
+
+// Adds the neighbours of all domains in mask (mask[d] != 0) to it
+std::vector<char> expand(const microdomains& mds, const std::vector<char>& mask);
+
 } //namespace fve
 } //namespace Foam
@@ -0,0 +1,112 @@
+/*
+ *
+ * Copyright: 2023 Ilya Popov <ilya.popov@isteq.nl>, ISTEQ BV
+ *
+ * SPDX-License-Identifier: GPL3.0-or-later
+ *
+ */
+
+#pragma once
+
+#include "expressions.hpp"
+
+#include "face_geometry.hpp"
+
+namespace Foam {
+namespace fve {
+
+// Same as linear_interpolate_expr, but takes owner, neighbour and weight from
+// the packed face records of face_geometry
+template<typename CellExpression>
+struct packed_interpolate_expr {
+    using value_type = typename CellExpression::value_type;
+    static_assert(CellExpression::location == loc::cell, "Argument ot interpolation must be cell expression");
+    static constexpr loc location = loc::face;
+    static constexpr bool has_surface_integrate = CellExpression::has_surface_integrate;
+    static constexpr int integrate_depth = CellExpression::integrate_depth;
+
+    CellExpression nested;
+    const std::vector<packed_face>& faces;
+
+    packed_interpolate_expr(CellExpression expr)
+        : nested(expr)
+        , faces(face_geometry::New(nested.mesh()).faces)
+    {}
+
+    value_type operator[](Foam::label facei) const {
+        const packed_face& f = faces[facei];
+        return f.weight*nested[f.owner] + (1-f.weight)*nested[f.neighbour];
+    }
+
+    value_type on_boundary(Foam::label patchi, Foam::label facei) const {
+        return nested.on_boundary(patchi, facei);
+    }
+
+    const Foam::fvMesh& mesh() const {
+        return nested.mesh();
+    }
+
+    Foam::dimensionSet dimensions() const {
+        return nested.dimensions();
+    }
+};
+
+template <typename Expr>
+struct is_expression<packed_interpolate_expr<Expr>> : std::true_type {};
+
+template <typename Expr>
+void prefetch_element(const packed_interpolate_expr<Expr>& e, Foam::label facei) {
+    const packed_face& f = e.faces[facei];
+    prefetch_element(e.nested, f.owner);
+    prefetch_element(e.nested, f.neighbour);
+}
+
+template <typename Expression, typename std::enable_if<is_expression<Expression>::value, int>::type = 0>
+auto packed_interpolate(Expression e) -> packed_interpolate_expr<Expression> {
+    return {e};
+}
+
+///////////////////////////////////////////////////////////////////////////////
+
+// Face area vectors from the packed face records. Used together with
+// packed_interpolate_expr the record is fetched only once per face.
+struct packed_Sf_expr {
+    using value_type = Foam::vector;
+    static constexpr loc location = loc::face;
+    static constexpr bool has_surface_integrate = false;
+    static constexpr int integrate_depth = 0;
+
+    const Foam::fvMesh& mesh_;
+    const std::vector<packed_face>& faces;
+
+    packed_Sf_expr(const Foam::fvMesh& mesh)
+        : mesh_(mesh)
+        , faces(face_geometry::New(mesh).faces)
+    {}
+
+    value_type operator[](Foam::label facei) const {
+        return faces[facei].Sf;
+    }
+
+    value_type on_boundary(Foam::label patchi, Foam::label facei) const {
+        return mesh_.Sf().boundaryField()[patchi][facei];
+    }
+
+    const Foam::fvMesh& mesh() const {
+        return mesh_;
+    }
+
+    Foam::dimensionSet dimensions() const {
+        return Foam::dimArea;
+    }
+};
+
+template <>
+struct is_expression<packed_Sf_expr> : std::true_type {};
+
+inline auto packed_Sf(const Foam::fvMesh& mesh) -> packed_Sf_expr {
+    return {mesh};
+}
+
+} // namespace fve
+} // namespace Foam
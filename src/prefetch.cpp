@@ -0,0 +1,40 @@
+/*
+ *
+ * Copyright: 2023 Ilya Popov <ilya.popov@isteq.nl>, ISTEQ BV
+ *
+ * SPDX-License-Identifier: GPL3.0-or-later
+ *
+ */
+
+#include "prefetch.hpp"
+
+#include <cstdlib>
+
+namespace {
+
+Foam::label env_label(const char* name, Foam::label default_value)
+{
+    const char* s = std::getenv(name);
+    if (s == nullptr || *s == '\0') {
+        return default_value;
+    }
+    return std::atol(s);
+}
+
+Foam::label& distance()
+{
+    static Foam::label d = env_label("FVE_PREFETCH_DISTANCE", 0);
+    return d;
+}
+
+} // namespace
+
+Foam::label Foam::fve::prefetch_distance()
+{
+    return distance();
+}
+
+void Foam::fve::set_prefetch_distance(Foam::label d)
+{
+    distance() = d < 0 ? 0 : d;
+}
@@ -0,0 +1,44 @@
+/*
+ *
+ * Copyright: 2023 Ilya Popov <ilya.popov@isteq.nl>, ISTEQ BV
+ *
+ * SPDX-License-Identifier: GPL3.0-or-later
+ *
+ */
+
+#pragma once
+
+#include "label.H"
+
+#include <cstddef>
+
+namespace Foam {
+namespace fve {
+
+// Software prefetching of gathered values. Loops over faces or cells that
+// read values of neighbouring cells look ahead this many elements and
+// prefetch what the element there will need. On well ordered meshes hardware
+// prefetchers do a better job, so it is off by default. The initial value is
+// taken from FVE_PREFETCH_DISTANCE environment variable, 0 disables it.
+Foam::label prefetch_distance();
+
+void set_prefetch_distance(Foam::label distance);
+
+constexpr std::size_t cache_line_size = 64;
+
+// Prefetches all cache lines of an object for reading
+template <typename T>
+inline void prefetch_object(const T& v)
+{
+    const char* p = reinterpret_cast<const char*>(&v);
+    for (std::size_t offset = 0; offset < sizeof(T); offset += cache_line_size) {
+        __builtin_prefetch(p + offset);
+    }
+    if (sizeof(T) > 1) {
+        // the object may straddle one more line
+        __builtin_prefetch(p + sizeof(T) - 1);
+    }
+}
+
+} // namespace fve
+} // namespace Foam
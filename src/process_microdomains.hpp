@@ -11,116 +11,295 @@
 #include "expressions.hpp"
 
 #include "microdomains.hpp"
-
-#include "boost/mp11/function.hpp"
+#include "thread_pool.hpp"
 
 namespace Foam {
 namespace fve {
 
-template <typename Type, template<class> class PatchField, typename Expression,
-         typename std::enable_if<Expression::has_surface_integrate, int>::type = 0>
-[[gnu::noinline]]
-void operator<<=(Foam::GeometricField<Type, PatchField, Foam::volMesh>& f, Expression e)
-{
-    static_assert(Expression::location == loc::cell,
-                  "Expression must have same location (cell or face) as the target field");
-    const fvMesh& mesh = e.mesh();
+// Adds contributions of coupled patches to all surface integrals of an
+// expression. Done once before the faces of microdomains are processed;
+// physical boundary faces are processed with the domain of their face cell.
+// Nodes performing surface integrals overload this, all other nodes pass it
+// to their children.
+template <typename Expr>
+void process_boundary(const Expr& e) {
+    for_each_child(e, [&](const auto& child) {
+        process_boundary(child);
+    });
+}
 
-    if (!e.dimensions().dimensionless()) {
-        // Check dimensions
-        f.dimensions() = e.dimensions();
+// Surface integrals nested inside each other are processed level by level,
+// level 1 being the innermost. A level can be processed on a domain once the
+// level below is complete on all cells the domain's faces touch, i.e. on all
+// domains up to last_neighbour. The wavefront processes each level only as
+// far as needed, so every level lags the one below by about one domain and
+// intermediate values are still in cache when they are consumed.
+template <typename Expression>
+class wavefront {
+public:
+    wavefront(const Expression& e, const microdomains& mds)
+        : e(e)
+        , mds(mds)
+        , processed(Expression::integrate_depth + 1, 0)
+    {
+        process_boundary(e);
     }
 
-    const auto mds = microdomains::New(mesh);
-
-    for (const auto&  md: mds.domains) {
-        process_microdomain(e, md);
+    // Processes all levels so that values of e are final on domain d
+    void complete(Foam::label d) {
+        advance(Expression::integrate_depth, d);
+    }
 
-        for (auto celli: md.cells) {
-            f[celli] = e[celli];
+private:
+    void advance(int level, Foam::label d) {
+        while (processed[level] <= d) {
+            Foam::label next = processed[level];
+            if (level > 1) {
+                advance(level - 1, mds.last_neighbour[next]);
+            }
+            process_microdomain(e, mds.domains[next], level);
+            processed[level]++;
         }
     }
 
-    Foam::label nPatches = mesh.boundary().size();
-    for (Foam::label patchi = 0; patchi < nPatches; patchi++) {
-        PatchField<Type>& patchField = f.boundaryFieldRef()[patchi];
-        Foam::label nFaces = patchField.size();
+    const Expression& e;
+    const microdomains& mds;
+    std::vector<Foam::label> processed;
+};
+
+// Scatter stage for the threaded path: groups of one colour do not share any
+// cells they write to, so they are split among the team, with a barrier before
+// the next colour. Inside a group domains are processed in order. Levels of
+// nested surface integrals are processed one after another.
+template <typename Expression>
+void process_microdomains(const Expression& e, const microdomains& mds, const thread_pool::team& t)
+{
+    if (t.id == 0) {
+        process_boundary(e);
+    }
+    t.barrier();
 
-        for (Foam::label facei = 0; facei < nFaces; facei++) {
-            patchField[facei] = e.on_boundary(patchi, facei);
+    for (int level = 1; level <= Expression::integrate_depth; ++level) {
+        for (const auto& groups: mds.colours) {
+            chunk c(0, groups.size(), t);
+            for (Foam::label i = c.begin; i < c.end; ++i) {
+                for (auto d: mds.groups[groups[i]].domains) {
+                    process_microdomain(e, mds.domains[d], level);
+                }
+            }
+            t.barrier();
         }
     }
 }
 
-template <typename Type, template<class> class PatchField, typename Expression,
-         typename std::enable_if<Expression::has_surface_integrate, int>::type = 0>
-[[gnu::noinline]]
-void operator<<=(Foam::GeometricField<Type, PatchField, Foam::surfaceMesh>& f, Expression e)
+// Same for a subset of domains: level l of surface integrals is computed on
+// the cells of the domains with masks[l][d] != 0, processing the domains with
+// reach[l][d] != 0, i.e. masks[l] and their neighbours, whose
+// own_boundary_faces contribute to them. See change_tracker.hpp.
+template <typename Expression>
+void process_microdomains(const Expression& e, const microdomains& mds,
+                          const std::vector<std::vector<char>>& masks,
+                          const std::vector<std::vector<char>>& reach,
+                          const thread_pool::team& t)
 {
-    static_assert(Expression::location == loc::face,
-                  "Expression must have same location (cell or face) as the target field");
-    const fvMesh& mesh = e.mesh();
+    for (int level = 1; level <= Expression::integrate_depth; ++level) {
+        const std::vector<char>& mask = masks[level];
+        auto include = [&](Foam::label celli) {
+            return mask[mds.cell_dist[celli]] != 0;
+        };
 
-    if (!e.dimensions().dimensionless()) {
-        // Check dimensions
-        f.dimensions() = e.dimensions();
+        if (t.id == 0) {
+            reset_cells(e, level, mask, include);
+        }
+        t.barrier();
+
+        for (const auto& groups: mds.colours) {
+            chunk c(0, groups.size(), t);
+            for (Foam::label i = c.begin; i < c.end; ++i) {
+                for (auto d: mds.groups[groups[i]].domains) {
+                    if (reach[level][d]) {
+                        process_microdomain(e, mds.domains[d], level, include);
+                    }
+                }
+            }
+            t.barrier();
+        }
     }
+}
 
-    const auto mds = microdomains::New(mesh);
+// Evaluates a cell expression with surface integrals on all internal cells,
+// calling assign(celli) for each cell once the values of e are final on it.
+// assign_patch(patchi, facei) is called for the physical boundary faces of a
+// domain right after its cells, and for faces of coupled patches at the end.
+template <typename Expression, typename Assign, typename AssignPatch>
+void assign_microdomain_cells(const Expression& e, Assign&& assign, AssignPatch&& assign_patch)
+{
+    const auto& mds = microdomains::New(e.mesh());
+    thread_pool& pool = thread_pool::instance();
+
+    auto assign_patch_face = [&](Foam::label patchi, Foam::label facei, Foam::label) {
+        assign_patch(patchi, facei);
+    };
 
-    for (const auto&  md: mds.domains) {
-        process_microdomain(e, md);
+    if (pool.size() == 1) {
+        wavefront<Expression> w(e, mds);
+        for (size_t d = 0; d < mds.domains.size(); ++d) {
+            w.complete(d);
 
-        // after we precomputed a domain, we can compute values in internal faces
-        for (auto facei: md.internal_faces) {
-            f[facei] = e[facei];
+            for (auto celli: mds.domains[d].cells) {
+                assign(celli);
+            }
+            for_each_patch_face(mds, mds.domains[d], assign_patch_face);
         }
     }
+    else {
+        pool.run([&](const thread_pool::team& t) {
+            process_microdomains(e, mds, t);
 
-    // after we computed all domains, we can compute boundary faces between domains
-    for (const auto&  md: mds.domains) {
-        for (auto facei: md.own_boundary_faces) {
-            f[facei] = e[facei];
-        }
+            chunk c(0, mds.groups.size(), t);
+            for (Foam::label g = c.begin; g < c.end; ++g) {
+                for (auto d: mds.groups[g].domains) {
+                    for (auto celli: mds.domains[d].cells) {
+                        assign(celli);
+                    }
+                    for_each_patch_face(mds, mds.domains[d], assign_patch_face);
+                }
+            }
+        });
     }
 
-    Foam::label nPatches = mesh.boundary().size();
-    for (Foam::label patchi = 0; patchi < nPatches; patchi++) {
-        PatchField<Type>& patchField = f.boundaryFieldRef()[patchi];
-        Foam::label nFaces = patchField.size();
+    for_each_coupled_patch_face(e.mesh(), mds, assign_patch_face);
+}
+
+// Same for face expressions with surface integrals, calling assign(facei)
+// for each internal face
+template <typename Expression, typename Assign, typename AssignPatch>
+void assign_microdomain_faces(const Expression& e, Assign&& assign, AssignPatch&& assign_patch)
+{
+    const auto& mds = microdomains::New(e.mesh());
+    thread_pool& pool = thread_pool::instance();
+
+    auto assign_patch_face = [&](Foam::label patchi, Foam::label facei, Foam::label) {
+        assign_patch(patchi, facei);
+    };
+
+    if (pool.size() == 1) {
+        wavefront<Expression> w(e, mds);
+        for (const auto& group: mds.groups) {
+            for (auto d: group.domains) {
+                const auto& md = mds.domains[d];
+                w.complete(d);
+
+                // after we precomputed a domain, we can compute values in internal faces
+                for (auto facei: md.internal_faces) {
+                    assign(facei);
+                }
+                for_each_patch_face(mds, md, assign_patch_face);
+            }
 
-        for (Foam::label facei = 0; facei < nFaces; facei++) {
-            patchField[facei] = e.on_boundary(patchi, facei);
+            // after we computed all domains of a group, we can compute boundary
+            // faces between domains that do not reach beyond this group
+            for (auto d: group.ready_domains) {
+                for (auto facei: mds.domains[d].own_boundary_faces) {
+                    assign(facei);
+                }
+            }
         }
     }
+    else {
+        pool.run([&](const thread_pool::team& t) {
+            process_microdomains(e, mds, t);
+
+            chunk c(0, mds.groups.size(), t);
+            for (Foam::label g = c.begin; g < c.end; ++g) {
+                for (auto d: mds.groups[g].domains) {
+                    const auto& md = mds.domains[d];
+                    for (auto facei: md.internal_faces) {
+                        assign(facei);
+                    }
+                    for (auto facei: md.own_boundary_faces) {
+                        assign(facei);
+                    }
+                    for_each_patch_face(mds, md, assign_patch_face);
+                }
+            }
+        });
+    }
+
+    for_each_coupled_patch_face(e.mesh(), mds, assign_patch_face);
 }
 
-template<typename, typename = void>
-struct has_nested : std::false_type {};
+template <typename Type, template<class> class PatchField, typename Expression,
+         typename std::enable_if<Expression::has_surface_integrate, int>::type = 0>
+[[gnu::noinline]]
+void operator<<=(Foam::GeometricField<Type, PatchField, Foam::volMesh>& f, Expression e)
+{
+    static_assert(Expression::location == loc::cell,
+                  "Expression must have same location (cell or face) as the target field");
+
+    if (!e.dimensions().dimensionless()) {
+        // Check dimensions
+        f.dimensions() = e.dimensions();
+    }
+
+    auto& bf = f.boundaryFieldRef();
+    assign_microdomain_cells(e, [&](Foam::label celli) {
+        f[celli] = e[celli];
+    }, [&](Foam::label patchi, Foam::label facei) {
+        bf[patchi][facei] = e.on_boundary(patchi, facei);
+    });
+}
 
-template<typename T>
-struct has_nested<T, typename boost::mp11::mp_void<decltype(std::declval<T>().nested)> > : std::true_type {};
+template <typename Type, template<class> class PatchField, typename Expression,
+         typename std::enable_if<Expression::has_surface_integrate, int>::type = 0>
+[[gnu::noinline]]
+void operator<<=(Foam::GeometricField<Type, PatchField, Foam::surfaceMesh>& f, Expression e)
+{
+    static_assert(Expression::location == loc::face,
+                  "Expression must have same location (cell or face) as the target field");
 
-template<typename, typename = void>
-struct has_lhs_rhs : std::false_type {};
+    if (!e.dimensions().dimensionless()) {
+        // Check dimensions
+        f.dimensions() = e.dimensions();
+    }
 
-template<typename T>
-struct has_lhs_rhs<T, typename boost::mp11::mp_void<decltype(std::declval<T>().lhs), decltype(std::declval<T>().rhs)> > : std::true_type {};
+    auto& bf = f.boundaryFieldRef();
+    assign_microdomain_faces(e, [&](Foam::label facei) {
+        f[facei] = e[facei];
+    }, [&](Foam::label patchi, Foam::label facei) {
+        bf[patchi][facei] = e.on_boundary(patchi, facei);
+    });
+}
 
-template <typename Expr, typename std::enable_if<has_nested<Expr>::value, int>::type = 0>
-void process_microdomain(const Expr& e, const microdomain& md) {
-    process_microdomain(e.nested, md);
+// Processes the given level of surface integrals of an expression on a
+// microdomain. Nodes performing surface integrals overload this to handle
+// their own level and pass lower levels to their argument, all other nodes
+// just pass it to their children.
+template <typename Expr>
+void process_microdomain(const Expr& e, const microdomain& md, int level) {
+    for_each_child(e, [&](const auto& child) {
+        process_microdomain(child, md, level);
+    });
 }
 
-template <typename Expr, typename std::enable_if<has_lhs_rhs<Expr>::value, int>::type = 0>
-void process_microdomain(const Expr& e, const microdomain& md) {
-    process_microdomain(e.lhs, md);
-    process_microdomain(e.rhs, md);
+// Same for recomputing a subset of cells, see change_tracker.hpp: only
+// contributions to cells for which include(celli) is true are added.
+template <typename Expr, typename Include>
+void process_microdomain(const Expr& e, const microdomain& md, int level, const Include& include) {
+    for_each_child(e, [&](const auto& child) {
+        process_microdomain(child, md, level, include);
+    });
 }
 
-template <typename Field>
-void process_microdomain(const field_expr<Field>& e, const microdomain& md) {
-    // do nothing
+// Prepares the surface integrals of the given level for recomputing a subset
+// of cells: zeroes the cells of the domains with mask[d] != 0, i.e. those for
+// which include(celli) is true, and adds the contributions of their coupled
+// patch faces. Costs a pass over the masked domains only, not the mesh.
+template <typename Expr, typename Include>
+void reset_cells(const Expr& e, int level, const std::vector<char>& mask, const Include& include) {
+    for_each_child(e, [&](const auto& child) {
+        reset_cells(child, level, mask, include);
+    });
 }
 
 } // namespace fve
@@ -0,0 +1,61 @@
+/*
+ *
+ * Copyright: 2023 Ilya Popov <ilya.popov@isteq.nl>, ISTEQ BV
+ *
+ * SPDX-License-Identifier: GPL3.0-or-later
+ *
+ */
+
+#include "recomputed_geometry.hpp"
+
+#include "symmTensorField.H"
+#include "defineDebugSwitch.H"
+
+namespace Foam {
+namespace fve {
+
+defineTypeNameAndDebug(ls_geometry, 0);
+
+} // namespace fve
+} // namespace Foam
+
+Foam::fve::ls_geometry::ls_geometry(const fvMesh &mesh)
+    : Foam::MeshObject<Foam::fvMesh, Foam::GeometricMeshObject, ls_geometry>(mesh)
+{
+    const Foam::labelUList& owner = mesh.owner();
+    const Foam::labelUList& neighbour = mesh.neighbour();
+    const Foam::vectorField& C = mesh.cellCentres();
+
+    Foam::symmTensorField dd(mesh.nCells(), Foam::Zero);
+
+    for (Foam::label facei = 0; facei < mesh.nInternalFaces(); facei++) {
+        Foam::vector d = C[neighbour[facei]] - C[owner[facei]];
+        Foam::symmTensor wdd = Foam::sqr(d)/Foam::magSqr(d);
+        dd[owner[facei]] += wdd;
+        dd[neighbour[facei]] += wdd;
+    }
+
+    boundary_faces.assign(mesh.nFaces() - mesh.nInternalFaces(), ls_boundary_face{-1, -1, Foam::Zero});
+
+    for (Foam::label patchi = 0; patchi < mesh.boundary().size(); patchi++) {
+        const Foam::fvPatch& patch = mesh.boundary()[patchi];
+        const Foam::labelUList& faceCells = patch.faceCells();
+        const Foam::vectorField pd(patch.delta());
+
+        for (Foam::label facei = 0; facei < patch.size(); facei++) {
+            dd[faceCells[facei]] += Foam::sqr(pd[facei])/Foam::magSqr(pd[facei]);
+            if (!patch.coupled()) {
+                boundary_faces[patch.start() + facei - mesh.nInternalFaces()] =
+                    ls_boundary_face{patchi, facei, pd[facei]/Foam::magSqr(pd[facei])};
+            }
+        }
+    }
+
+    const Foam::symmTensorField invDd(Foam::inv(dd));
+    inv_dd.assign(invDd.begin(), invDd.end());
+}
+
+Foam::fve::ls_geometry::~ls_geometry()
+{
+
+}
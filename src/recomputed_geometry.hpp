@@ -0,0 +1,316 @@
+/*
+ *
+ * Copyright: 2023 Ilya Popov <ilya.popov@isteq.nl>, ISTEQ BV
+ *
+ * SPDX-License-Identifier: GPL3.0-or-later
+ *
+ */
+
+#pragma once
+
+#include "expressions.hpp"
+
+#include "fvMesh.H"
+#include "MeshObject.H"
+#include "symmTensor.H"
+
+#include <vector>
+
+namespace Foam {
+namespace fve {
+
+// Expression nodes that recompute face geometry from points and cell centres
+// instead of reading the stored Sf, weights and least squares vectors. They
+// trade flops for memory traffic: per face they read the point labels of the
+// face and its points, which are shared with neighbouring faces and mostly in
+// cache on a well ordered mesh. Results equal the stored geometry up to
+// rounding.
+
+// Area vector and centre of a face, computed as in primitiveMesh: triangles
+// spanned by the edges and the average of the points
+inline void face_area_and_centre(const Foam::face& f, const Foam::pointField& points, Foam::vector& Sf, Foam::vector& Cf)
+{
+    const Foam::label nPoints = f.size();
+
+    if (nPoints == 3) {
+        const Foam::point& p0 = points[f[0]];
+        const Foam::point& p1 = points[f[1]];
+        const Foam::point& p2 = points[f[2]];
+        Cf = (1.0/3.0)*(p0 + p1 + p2);
+        Sf = 0.5*((p1 - p0) ^ (p2 - p0));
+        return;
+    }
+
+    Foam::vector sumN = Foam::Zero;
+    Foam::scalar sumA = 0;
+    Foam::vector sumAc = Foam::Zero;
+
+    Foam::point fCentre = points[f[0]];
+    for (Foam::label pi = 1; pi < nPoints; pi++) {
+        fCentre += points[f[pi]];
+    }
+    fCentre /= nPoints;
+
+    for (Foam::label pi = 0; pi < nPoints; pi++) {
+        const Foam::point& p = points[f[pi]];
+        const Foam::point& next = points[f[(pi + 1) % nPoints]];
+
+        Foam::vector c = p + next + fCentre;
+        Foam::vector n = (next - p) ^ (fCentre - p);
+        Foam::scalar a = Foam::mag(n);
+
+        sumN += n;
+        sumA += a;
+        sumAc += a*c;
+    }
+
+    if (sumA < Foam::ROOTVSMALL) {
+        Cf = fCentre;
+        Sf = Foam::Zero;
+    }
+    else {
+        Cf = (1.0/3.0)*sumAc/sumA;
+        Sf = 0.5*sumN;
+    }
+}
+
+// Linear interpolation weight of an internal face, as in surfaceInterpolation
+inline Foam::scalar face_weight(const Foam::vector& Sf, const Foam::vector& Cf, const Foam::point& C_own, const Foam::point& C_nei)
+{
+    Foam::scalar SfdOwn = Foam::mag(Sf & (Cf - C_own));
+    Foam::scalar SfdNei = Foam::mag(Sf & (C_nei - Cf));
+    return SfdNei/(SfdOwn + SfdNei);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+
+// Face area vectors recomputed from points. On boundary faces the stored
+// values are used.
+struct recomputed_Sf_expr {
+    using value_type = Foam::vector;
+    static constexpr loc location = loc::face;
+    static constexpr bool has_surface_integrate = false;
+    static constexpr int integrate_depth = 0;
+
+    const Foam::fvMesh& mesh_;
+    const Foam::faceList& faces;
+    const Foam::pointField& points;
+
+    recomputed_Sf_expr(const Foam::fvMesh& mesh)
+        : mesh_(mesh)
+        , faces(mesh.faces())
+        , points(mesh.points())
+    {}
+
+    value_type operator[](Foam::label facei) const {
+        Foam::vector Sf, Cf;
+        face_area_and_centre(faces[facei], points, Sf, Cf);
+        return Sf;
+    }
+
+    value_type on_boundary(Foam::label patchi, Foam::label facei) const {
+        return mesh_.Sf().boundaryField()[patchi][facei];
+    }
+
+    const Foam::fvMesh& mesh() const {
+        return mesh_;
+    }
+
+    Foam::dimensionSet dimensions() const {
+        return Foam::dimArea;
+    }
+};
+
+template <>
+struct is_expression<recomputed_Sf_expr> : std::true_type {};
+
+inline auto recomputed_Sf(const Foam::fvMesh& mesh) -> recomputed_Sf_expr {
+    return {mesh};
+}
+
+///////////////////////////////////////////////////////////////////////////////
+
+// Same as linear_interpolate_expr, with the weight recomputed from the face
+// points and the centres of both cells
+template<typename CellExpression>
+struct recomputed_interpolate_expr {
+    using value_type = typename CellExpression::value_type;
+    static_assert(CellExpression::location == loc::cell, "Argument ot interpolation must be cell expression");
+    static constexpr loc location = loc::face;
+    static constexpr bool has_surface_integrate = CellExpression::has_surface_integrate;
+    static constexpr int integrate_depth = CellExpression::integrate_depth;
+
+    CellExpression nested;
+    const Foam::labelUList& owner;
+    const Foam::labelUList& neighbour;
+    const Foam::faceList& faces;
+    const Foam::pointField& points;
+    const Foam::vectorField& C;
+
+    recomputed_interpolate_expr(CellExpression expr)
+        : nested(expr)
+        , owner(nested.mesh().owner())
+        , neighbour(nested.mesh().neighbour())
+        , faces(nested.mesh().faces())
+        , points(nested.mesh().points())
+        , C(nested.mesh().cellCentres())
+    {}
+
+    value_type operator[](Foam::label facei) const {
+        auto own = owner[facei];
+        auto nei = neighbour[facei];
+        Foam::vector Sf, Cf;
+        face_area_and_centre(faces[facei], points, Sf, Cf);
+        auto w = face_weight(Sf, Cf, C[own], C[nei]);
+        return w*nested[own] + (1-w)*nested[nei];
+    }
+
+    value_type on_boundary(Foam::label patchi, Foam::label facei) const {
+        return nested.on_boundary(patchi, facei);
+    }
+
+    const Foam::fvMesh& mesh() const {
+        return nested.mesh();
+    }
+
+    Foam::dimensionSet dimensions() const {
+        return nested.dimensions();
+    }
+};
+
+template <typename Expr>
+struct is_expression<recomputed_interpolate_expr<Expr>> : std::true_type {};
+
+template <typename Expr>
+void prefetch_element(const recomputed_interpolate_expr<Expr>& e, Foam::label facei) {
+    prefetch_element(e.nested, e.owner[facei]);
+    prefetch_element(e.nested, e.neighbour[facei]);
+}
+
+template <typename Expression, typename std::enable_if<is_expression<Expression>::value, int>::type = 0>
+auto recomputed_interpolate(Expression e) -> recomputed_interpolate_expr<Expression> {
+    return {e};
+}
+
+///////////////////////////////////////////////////////////////////////////////
+
+// Face of a physical (not coupled) boundary patch in the least squares
+// gradient: the patch, the face in it and d/|d|^2 of the patch delta d
+struct ls_boundary_face {
+    Foam::label patchi;
+    Foam::label facei;
+    Foam::vector d;
+};
+
+// Inverse of the least squares matrix of every cell, as in leastSquaresVectors.
+// With it the least squares vector of a face is recomputed from the cell
+// centres: pVectors = inv_dd[own] & d/|d|^2, nVectors = -inv_dd[nei] & d/|d|^2,
+// d = C[nei] - C[own]. One symmetric tensor per cell replaces two vectors per
+// face.
+struct ls_geometry : public Foam::MeshObject<Foam::fvMesh, Foam::GeometricMeshObject, ls_geometry> {
+    TypeName("ls_geometry");
+
+    std::vector<Foam::symmTensor> inv_dd;
+
+    // Indexed by face - nInternalFaces. patchi is -1 for faces of coupled
+    // and empty patches, which the gradient skips.
+    std::vector<ls_boundary_face> boundary_faces;
+
+    explicit ls_geometry(const Foam::fvMesh& mesh);
+    virtual ~ls_geometry();
+};
+
+// Same as the generic path of grad_expr, with the least squares vectors
+// recomputed from cell centres: the weighted differences of the neighbours
+// are summed first and multiplied by inv_dd once per cell. Unlike grad_expr,
+// faces of physical boundary patches contribute with the boundary value of
+// the argument, as in leastSquaresGrad. Faces of coupled patches are skipped:
+// the cell values on the other side are not available to expressions, so
+// there the gradient is one-sided although inv_dd includes those faces.
+template<typename CellExpr>
+struct recomputed_grad_expr {
+    using value_type = typename Foam::outerProduct<Foam::vector, typename CellExpr::value_type>::type;
+    static_assert(CellExpr::location == loc::cell, "Argument to gradient must be cell expression");
+    static constexpr loc location = loc::cell;
+    static constexpr bool has_surface_integrate = false;
+    static constexpr int integrate_depth = CellExpr::integrate_depth;
+
+    CellExpr nested;
+    const Foam::labelUList& owner;
+    const Foam::labelUList& neighbour;
+    const Foam::cellList& cells;
+    const Foam::vectorField& C;
+    const std::vector<Foam::symmTensor>& inv_dd;
+    const std::vector<ls_boundary_face>& boundary_faces;
+
+    recomputed_grad_expr(const CellExpr& arg)
+        : nested(arg)
+        , owner(arg.mesh().owner())
+        , neighbour(arg.mesh().neighbour())
+        , cells(arg.mesh().cells())
+        , C(arg.mesh().cellCentres())
+        , inv_dd(ls_geometry::New(arg.mesh()).inv_dd)
+        , boundary_faces(ls_geometry::New(arg.mesh()).boundary_faces)
+    {}
+
+    value_type operator [](Foam::label celli) const {
+        const Foam::cell &cell = cells[celli];
+
+        value_type sum{};
+        auto val = nested[celli];
+        const Foam::point& c = C[celli];
+
+        for (Foam::label facei: cell) {
+            if (facei < owner.size()) {
+                auto own = owner[facei];
+                auto other = own == celli ? neighbour[facei] : own;
+                Foam::vector d = C[other] - c;
+                sum += (d/Foam::magSqr(d)) * (nested[other] - val);
+            }
+            else {
+                const ls_boundary_face& b = boundary_faces[facei - owner.size()];
+                if (b.patchi >= 0) {
+                    sum += b.d * (nested.on_boundary(b.patchi, b.facei) - val);
+                }
+            }
+        }
+
+        return inv_dd[celli] & sum;
+    }
+
+    // Extrapolated from the face cell, like the extrapolatedCalculated
+    // patches of fvc::grad
+    value_type on_boundary(Foam::label patchi, Foam::label facei) const {
+        return (*this)[nested.mesh().boundary()[patchi].faceCells()[facei]];
+    }
+
+    const fvMesh& mesh() const {
+        return nested.mesh();
+    }
+
+    Foam::dimensionSet dimensions() const {
+        // This is a hack just to represent unknown dimensions
+        return nested.dimensions() / Foam::dimLength;
+    }
+};
+
+template<typename Expr>
+struct is_expression<recomputed_grad_expr<Expr>> : std::true_type {};
+
+template <typename Expr>
+void prefetch_element(const recomputed_grad_expr<Expr>& e, Foam::label celli) {
+    for (Foam::label facei: e.cells[celli]) {
+        if (facei < e.owner.size()) {
+            prefetch_element(e.nested, e.owner[facei]);
+            prefetch_element(e.nested, e.neighbour[facei]);
+        }
+    }
+}
+
+template <typename CellExpr, typename std::enable_if<is_expression<CellExpr>::value, int>::type = 0>
+auto recomputed_grad(const CellExpr& arg) -> recomputed_grad_expr<CellExpr> {
+    return {arg};
+}
+
+} // namespace fve
+} // namespace Foam
@@ -0,0 +1,266 @@
+/*
+ *
+ * Copyright: 2023 Ilya Popov <ilya.popov@isteq.nl>, ISTEQ BV
+ *
+ * SPDX-License-Identifier: GPL3.0-or-later
+ *
+ */
+
+#pragma once
+
+#include "expressions.hpp"
+
+#include "microdomains.hpp"
+#include "process_microdomains.hpp"
+#include "thread_pool.hpp"
+
+#include "ops.H"
+#include "PstreamReduceOps.H"
+
+#include <algorithm>
+#include <vector>
+
+namespace Foam {
+namespace fve {
+
+// Reductions are computed over internal cells or internal faces, like gSum and
+// friends. Partial results are accumulated per block of elements (or per
+// microdomain) and combined in block order, so the result does not depend on
+// the number of threads. Values of surface integrals are sums over faces, so
+// for expressions containing them the faces are also scattered in an order
+// independent of the number of threads: colour by colour over groups of
+// domains (see process_microdomains), also with one thread. The default
+// group size does not depend on the number of threads either, see
+// microdomains::groups; setting FVE_GROUP_CELLS differently changes the
+// last bits of the result.
+
+struct sum_op {
+    template <typename T> using result_type = T;
+    template <typename R> static R identity() { return Foam::pTraits<R>::zero; }
+    template <typename R, typename T> static void accumulate(R& acc, const T& v) { acc += v; }
+    template <typename R> static void combine(R& acc, const R& partial) { acc += partial; }
+    template <typename R> static void all_reduce(R& acc) { Foam::reduce(acc, Foam::sumOp<R>()); }
+};
+
+struct max_op {
+    template <typename T> using result_type = T;
+    template <typename R> static R identity() { return Foam::pTraits<R>::min; }
+    template <typename R, typename T> static void accumulate(R& acc, const T& v) { acc = Foam::max(acc, v); }
+    template <typename R> static void combine(R& acc, const R& partial) { acc = Foam::max(acc, partial); }
+    template <typename R> static void all_reduce(R& acc) { Foam::reduce(acc, Foam::maxOp<R>()); }
+};
+
+struct min_op {
+    template <typename T> using result_type = T;
+    template <typename R> static R identity() { return Foam::pTraits<R>::max; }
+    template <typename R, typename T> static void accumulate(R& acc, const T& v) { acc = Foam::min(acc, v); }
+    template <typename R> static void combine(R& acc, const R& partial) { acc = Foam::min(acc, partial); }
+    template <typename R> static void all_reduce(R& acc) { Foam::reduce(acc, Foam::minOp<R>()); }
+};
+
+struct sum_mag_op {
+    template <typename T> using result_type = Foam::scalar;
+    template <typename R> static R identity() { return 0; }
+    template <typename R, typename T> static void accumulate(R& acc, const T& v) { acc += Foam::mag(v); }
+    template <typename R> static void combine(R& acc, const R& partial) { acc += partial; }
+    template <typename R> static void all_reduce(R& acc) { Foam::reduce(acc, Foam::sumOp<R>()); }
+};
+
+struct sum_mag_sqr_op {
+    template <typename T> using result_type = Foam::scalar;
+    template <typename R> static R identity() { return 0; }
+    template <typename R, typename T> static void accumulate(R& acc, const T& v) { acc += Foam::magSqr(v); }
+    template <typename R> static void combine(R& acc, const R& partial) { acc += partial; }
+    template <typename R> static void all_reduce(R& acc) { Foam::reduce(acc, Foam::sumOp<R>()); }
+};
+
+template <typename Op, typename Expression>
+using reduction_result = typename Op::template result_type<typename Expression::value_type>;
+
+// Number of elements reduced into one partial result when the expression
+// does not need microdomains
+constexpr Foam::label reduction_block_size = 4096;
+
+template <typename Expression>
+Foam::label n_internal(const Expression& e) {
+    return Expression::location == loc::cell ? e.mesh().nCells() : e.mesh().nInternalFaces();
+}
+
+// Evaluates e on all internal elements, calling visit(i, value) for each of
+// them, and returns the reduction of the values on this processor.
+template <typename Op, typename Expression, typename Visit,
+         typename std::enable_if<!Expression::has_surface_integrate, int>::type = 0>
+auto reduce_internal(const Expression& e, Visit&& visit) -> reduction_result<Op, Expression>
+{
+    using result_type = reduction_result<Op, Expression>;
+
+    const Foam::label n = n_internal(e);
+    const Foam::label n_blocks = (n + reduction_block_size - 1) / reduction_block_size;
+    std::vector<result_type> partial(n_blocks, Op::template identity<result_type>());
+
+    parallel_for(0, n_blocks, [&](Foam::label begin, Foam::label end) {
+        for (Foam::label b = begin; b < end; ++b) {
+            result_type acc = Op::template identity<result_type>();
+            Foam::label i_end = std::min(n, (b + 1)*reduction_block_size);
+            for_each_element(e, b*reduction_block_size, i_end, [&](Foam::label i) {
+                auto v = e[i];
+                visit(i, v);
+                Op::accumulate(acc, v);
+            });
+            partial[b] = acc;
+        }
+    }, 1);
+
+    result_type result = Op::template identity<result_type>();
+    for (const auto& p: partial) {
+        Op::combine(result, p);
+    }
+    return result;
+}
+
+template <typename Op, typename Expression, typename Visit,
+         typename std::enable_if<Expression::has_surface_integrate && Expression::location == loc::cell, int>::type = 0>
+auto reduce_internal(const Expression& e, Visit&& visit) -> reduction_result<Op, Expression>
+{
+    using result_type = reduction_result<Op, Expression>;
+
+    const auto& mds = microdomains::New(e.mesh());
+    std::vector<result_type> partial(mds.domains.size(), Op::template identity<result_type>());
+
+    auto reduce_domain = [&](Foam::label d) {
+        result_type acc = Op::template identity<result_type>();
+        for (auto celli: mds.domains[d].cells) {
+            auto v = e[celli];
+            visit(celli, v);
+            Op::accumulate(acc, v);
+        }
+        partial[d] = acc;
+    };
+
+    // Not the wavefront with one thread: it adds the faces to cells in
+    // another order than the threaded path
+    thread_pool::instance().run([&](const thread_pool::team& t) {
+        process_microdomains(e, mds, t);
+
+        chunk c(0, mds.groups.size(), t);
+        for (Foam::label g = c.begin; g < c.end; ++g) {
+            for (auto d: mds.groups[g].domains) {
+                reduce_domain(d);
+            }
+        }
+    });
+
+    result_type result = Op::template identity<result_type>();
+    for (const auto& p: partial) {
+        Op::combine(result, p);
+    }
+    return result;
+}
+
+template <typename Op, typename Expression, typename Visit,
+         typename std::enable_if<Expression::has_surface_integrate && Expression::location == loc::face, int>::type = 0>
+auto reduce_internal(const Expression& e, Visit&& visit) -> reduction_result<Op, Expression>
+{
+    using result_type = reduction_result<Op, Expression>;
+
+    const auto& mds = microdomains::New(e.mesh());
+    std::vector<result_type> partial(mds.domains.size(), Op::template identity<result_type>());
+
+    auto reduce_faces = [&](Foam::label d, const index_range& faces) {
+        for (auto facei: faces) {
+            auto v = e[facei];
+            visit(facei, v);
+            Op::accumulate(partial[d], v);
+        }
+    };
+
+    // Same order of faces with any number of threads, as above
+    thread_pool::instance().run([&](const thread_pool::team& t) {
+        process_microdomains(e, mds, t);
+
+        chunk c(0, mds.groups.size(), t);
+        for (Foam::label g = c.begin; g < c.end; ++g) {
+            for (auto d: mds.groups[g].domains) {
+                reduce_faces(d, mds.domains[d].internal_faces);
+                reduce_faces(d, mds.domains[d].own_boundary_faces);
+            }
+        }
+    });
+
+    result_type result = Op::template identity<result_type>();
+    for (const auto& p: partial) {
+        Op::combine(result, p);
+    }
+    return result;
+}
+
+// Reduction of an expression over all processors
+template <typename Op, typename Expression, typename std::enable_if<is_expression<Expression>::value, int>::type = 0>
+auto reduce_expression(Expression e) -> reduction_result<Op, Expression>
+{
+    auto result = reduce_internal<Op>(e, [](Foam::label, const typename Expression::value_type&) {});
+    Op::all_reduce(result);
+    return result;
+}
+
+template <typename Expression, typename std::enable_if<is_expression<Expression>::value, int>::type = 0>
+auto sum(Expression e) -> reduction_result<sum_op, Expression> {
+    return reduce_expression<sum_op>(e);
+}
+
+template <typename Expression, typename std::enable_if<is_expression<Expression>::value, int>::type = 0>
+auto max(Expression e) -> reduction_result<max_op, Expression> {
+    return reduce_expression<max_op>(e);
+}
+
+template <typename Expression, typename std::enable_if<is_expression<Expression>::value, int>::type = 0>
+auto min(Expression e) -> reduction_result<min_op, Expression> {
+    return reduce_expression<min_op>(e);
+}
+
+template <typename Expression, typename std::enable_if<is_expression<Expression>::value, int>::type = 0>
+auto sumMag(Expression e) -> Foam::scalar {
+    return reduce_expression<sum_mag_op>(e);
+}
+
+template <typename Expression, typename std::enable_if<is_expression<Expression>::value, int>::type = 0>
+auto norm2(Expression e) -> Foam::scalar {
+    return Foam::sqrt(reduce_expression<sum_mag_sqr_op>(e));
+}
+
+// Same as f <<= e, additionally returning the reduction of the assigned
+// internal values over all processors, e.g.
+//     scalar imbalance = assign_and_reduce<sum_op>(divPhi, div(...));
+template <typename Op, typename Type, template<class> class PatchField, typename GeoMesh, typename Expression>
+[[gnu::noinline]]
+auto assign_and_reduce(Foam::GeometricField<Type, PatchField, GeoMesh>& f, Expression e) -> reduction_result<Op, Expression>
+{
+    static_assert(Expression::location == (Foam::isVolMesh<GeoMesh>::value ? loc::cell : loc::face),
+                  "Expression must have same location (cell or face) as the target field");
+    const fvMesh& mesh = e.mesh();
+
+    if (!e.dimensions().dimensionless()) {
+        // Check dimensions
+        f.dimensions() = e.dimensions();
+    }
+
+    auto result = reduce_internal<Op>(e, [&](Foam::label i, const typename Expression::value_type& v) {
+        f[i] = v;
+    });
+
+    Foam::label nPatches = mesh.boundary().size();
+    for (Foam::label patchi = 0; patchi < nPatches; patchi++) {
+        PatchField<Type>& patchField = f.boundaryFieldRef()[patchi];
+        Foam::label nFaces = patchField.size();
+
+        for (Foam::label facei = 0; facei < nFaces; facei++) {
+            patchField[facei] = e.on_boundary(patchi, facei);
+        }
+    }
+
+    Op::all_reduce(result);
+    return result;
+}
+
+} // namespace fve
+} // namespace Foam
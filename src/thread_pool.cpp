@@ -0,0 +1,205 @@
+/*
+ *
+ * Copyright: 2023 Ilya Popov <ilya.popov@isteq.nl>, ISTEQ BV
+ *
+ * SPDX-License-Identifier: GPL3.0-or-later
+ *
+ */
+
+#include "thread_pool.hpp"
+
+#include <cstdlib>
+
+#include <pthread.h>
+#include <sched.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
+
+namespace {
+
+inline void cpu_relax()
+{
+#if defined(__x86_64__) || defined(__i386__)
+    _mm_pause();
+#endif
+}
+
+// After this many polls a waiting thread starts yielding its core, and an
+// idle worker goes to sleep after yield_limit more
+constexpr int spin_limit = 1 << 16;
+constexpr int yield_limit = 1 << 10;
+
+// Waits until done() returns true: spins, then yields
+template <typename Done>
+void spin_then_yield(Done&& done)
+{
+    int spins = 0;
+    while (!done()) {
+        if (++spins < spin_limit) {
+            cpu_relax();
+        }
+        else {
+            std::this_thread::yield();
+        }
+    }
+}
+
+int env_int(const char* name, int default_value)
+{
+    const char* s = std::getenv(name);
+    if (s == nullptr || *s == '\0') {
+        return default_value;
+    }
+    return std::atoi(s);
+}
+
+// Pins the calling thread to the i-th cpu of the given affinity mask of the
+// process. The mask has to be read before any thread is pinned: new threads
+// inherit the mask of the thread that creates them.
+void pin_to_core(const cpu_set_t& allowed, int i)
+{
+    int n_allowed = CPU_COUNT(&allowed);
+    if (n_allowed == 0) {
+        return;
+    }
+    int target = i % n_allowed;
+    for (int cpu = 0; cpu < CPU_SETSIZE; ++cpu) {
+        if (CPU_ISSET(cpu, &allowed) && target-- == 0) {
+            cpu_set_t set;
+            CPU_ZERO(&set);
+            CPU_SET(cpu, &set);
+            pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+            return;
+        }
+    }
+}
+
+} // namespace
+
+thread_local bool Foam::fve::thread_pool::in_job = false;
+
+Foam::fve::thread_pool& Foam::fve::thread_pool::instance()
+{
+    static thread_pool pool(env_int("FVE_NUM_THREADS", 1), env_int("FVE_PIN_THREADS", 1) != 0);
+    return pool;
+}
+
+Foam::fve::thread_pool::thread_pool(int n, bool pin)
+    : n_threads(n < 1 ? 1 : n)
+{
+    CPU_ZERO(&affinity);
+    if (n_threads == 1) {
+        return;
+    }
+
+    if (pin && sched_getaffinity(0, sizeof(affinity), &affinity) != 0) {
+        CPU_ZERO(&affinity);
+        pin = false;
+    }
+
+    workers.reserve(n_threads - 1);
+    for (int id = 1; id < n_threads; ++id) {
+        workers.emplace_back([this, id, pin] {
+            if (pin) {
+                pin_to_core(affinity, id);
+            }
+            worker(id);
+        });
+    }
+
+    // Pinned last: threads created afterwards inherit its mask, see
+    // process_affinity
+    if (pin) {
+        pin_to_core(affinity, 0);
+    }
+}
+
+Foam::fve::thread_pool::~thread_pool()
+{
+    stop.store(true, std::memory_order_relaxed);
+    publish();
+    for (auto& w: workers) {
+        w.join();
+    }
+}
+
+void Foam::fve::thread_pool::publish()
+{
+    // Sequentially consistent with the sleepers check in worker(): either
+    // the worker sees the new generation or it is counted here and woken up
+    generation.fetch_add(1, std::memory_order_seq_cst);
+    if (sleepers.load(std::memory_order_seq_cst) > 0) {
+        std::lock_guard<std::mutex> lock(sleep_mutex);
+        wake.notify_all();
+    }
+}
+
+void Foam::fve::thread_pool::dispatch()
+{
+    pending.store(n_threads - 1, std::memory_order_relaxed);
+    publish();
+
+    execute(0);
+
+    spin_then_yield([this] {
+        return pending.load(std::memory_order_acquire) == 0;
+    });
+}
+
+void Foam::fve::thread_pool::execute(int id)
+{
+    in_job = true;
+    job(job_ctx, team{id, n_threads, this});
+    in_job = false;
+}
+
+void Foam::fve::thread_pool::worker(int id)
+{
+    unsigned seen = 0;
+    for (;;) {
+        unsigned g;
+        int spins = 0;
+        while ((g = generation.load(std::memory_order_acquire)) == seen) {
+            if (++spins < spin_limit) {
+                cpu_relax();
+            }
+            else if (spins < spin_limit + yield_limit) {
+                std::this_thread::yield();
+            }
+            else {
+                // Idle for long, e.g. during serial OpenFOAM code: sleep
+                // until the next job
+                std::unique_lock<std::mutex> lock(sleep_mutex);
+                sleepers.fetch_add(1, std::memory_order_seq_cst);
+                while ((g = generation.load(std::memory_order_seq_cst)) == seen) {
+                    wake.wait(lock);
+                }
+                sleepers.fetch_sub(1, std::memory_order_relaxed);
+            }
+        }
+        seen = g;
+
+        if (stop.load(std::memory_order_relaxed)) {
+            return;
+        }
+
+        execute(id);
+        pending.fetch_sub(1, std::memory_order_acq_rel);
+    }
+}
+
+void Foam::fve::thread_pool::barrier()
+{
+    unsigned g = barrier_generation.load(std::memory_order_acquire);
+    if (barrier_count.fetch_add(1, std::memory_order_acq_rel) == n_threads - 1) {
+        barrier_count.store(0, std::memory_order_relaxed);
+        barrier_generation.fetch_add(1, std::memory_order_release);
+    }
+    else {
+        spin_then_yield([this, g] {
+            return barrier_generation.load(std::memory_order_acquire) != g;
+        });
+    }
+}
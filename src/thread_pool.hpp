@@ -0,0 +1,153 @@
+/*
+ *
+ * Copyright: 2023 Ilya Popov <ilya.popov@isteq.nl>, ISTEQ BV
+ *
+ * SPDX-License-Identifier: GPL3.0-or-later
+ *
+ */
+
+#pragma once
+
+#include "label.H"
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+#include <sched.h>
+
+namespace Foam {
+namespace fve {
+
+// Persistent pool of worker threads pinned to cores. Workers spin on a
+// generation counter between jobs, so fork/join costs a couple of cache line
+// transfers instead of a thread start-up. Workers idle for longer yield and
+// then sleep, so serial code between jobs keeps the cores to itself.
+//
+// The number of threads is taken from FVE_NUM_THREADS environment variable
+// (default 1, i.e. everything runs on the calling thread). Pinning can be
+// switched off with FVE_PIN_THREADS=0.
+class thread_pool {
+public:
+    // Threads participating in a job. The calling thread is always id 0.
+    struct team {
+        int id;
+        int size;
+        thread_pool* pool;
+
+        void barrier() const {
+            if (size > 1) {
+                pool->barrier();
+            }
+        }
+    };
+
+    static thread_pool& instance();
+
+    explicit thread_pool(int n_threads, bool pin = true);
+    ~thread_pool();
+
+    thread_pool(const thread_pool&) = delete;
+    thread_pool& operator=(const thread_pool&) = delete;
+
+    int size() const {
+        return n_threads;
+    }
+
+    // Calls func(const team&) on every thread of the pool and returns when all
+    // of them have finished. Jobs started from inside a job run inline on the
+    // calling thread as a team of one.
+    template <typename Func>
+    void run(Func&& func) {
+        if (n_threads == 1 || in_job) {
+            func(team{0, 1, this});
+            return;
+        }
+        using func_type = typename std::remove_reference<Func>::type;
+        job = &invoke<func_type>;
+        job_ctx = const_cast<void*>(static_cast<const void*>(std::addressof(func)));
+        dispatch();
+    }
+
+    void barrier();
+
+    // Affinity mask of the process, read before any thread was pinned. The
+    // calling thread is pinned to one core and threads it starts afterwards
+    // inherit that; those not working for the pool (e.g. async_writer) reset
+    // their mask to this one. Empty if threads are not pinned.
+    const cpu_set_t& process_affinity() const {
+        return affinity;
+    }
+
+private:
+    template <typename Func>
+    static void invoke(void* ctx, const team& t) {
+        (*static_cast<Func*>(ctx))(t);
+    }
+
+    void publish();
+    void dispatch();
+    void execute(int id);
+    void worker(int id);
+
+    int n_threads;
+    cpu_set_t affinity;
+    std::vector<std::thread> workers;
+
+    void (*job)(void*, const team&) = nullptr;
+    void* job_ctx = nullptr;
+
+    // Each counter lives on its own cache line to avoid false sharing between
+    // the master publishing a job and workers reporting completion.
+    alignas(64) std::atomic<unsigned> generation{0};
+    alignas(64) std::atomic<int> pending{0};
+    alignas(64) std::atomic<int> barrier_count{0};
+    alignas(64) std::atomic<unsigned> barrier_generation{0};
+    alignas(64) std::atomic<bool> stop{false};
+
+    // Workers sleeping on wake, and what they sleep with
+    alignas(64) std::atomic<int> sleepers{0};
+    std::mutex sleep_mutex;
+    std::condition_variable wake;
+
+    static thread_local bool in_job;
+};
+
+// Splits [begin, end) into contiguous chunks, one per team member. The bounds
+// are computed in 64 bits: with 32-bit labels n * id overflows for ranges of
+// tens of millions of elements and tens of threads.
+struct chunk {
+    Foam::label begin;
+    Foam::label end;
+
+    chunk(Foam::label b, Foam::label e, const thread_pool::team& t)
+    {
+        const std::int64_t n = static_cast<std::int64_t>(e) - b;
+        begin = static_cast<Foam::label>(b + (n * t.id) / t.size);
+        end   = static_cast<Foam::label>(b + (n * (t.id + 1)) / t.size);
+    }
+};
+
+// Calls func(chunk_begin, chunk_end) for the static partition of [begin, end)
+// among the threads of the pool. Small ranges are run inline.
+template <typename Func>
+void parallel_for(Foam::label begin, Foam::label end, Func&& func, Foam::label grain = 1024)
+{
+    thread_pool& pool = thread_pool::instance();
+    if (pool.size() == 1 || end - begin <= grain) {
+        func(begin, end);
+        return;
+    }
+    pool.run([&](const thread_pool::team& t) {
+        chunk c(begin, end, t);
+        func(c.begin, c.end);
+    });
+}
+
+} // namespace fve
+} // namespace Foam
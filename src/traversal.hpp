@@ -15,8 +15,12 @@
 
 #include <tuple>
 #include <functional>
+#include <initializer_list>
 #include "boost/mp11/tuple.hpp"
 
+#include "prefetch.hpp"
+#include "thread_pool.hpp"
+
 template <typename Field>
 struct value_type;
 
@@ -47,9 +51,9 @@ struct patch_type<Foam::GeometricField<Type, PatchField, GeoMesh>> {
 
 struct get_patch
 {
-    int patchi;
+    Foam::label patchi;
 
-    get_patch(int patchi)
+    get_patch(Foam::label patchi)
         :patchi(patchi)
     {}
 
@@ -69,9 +73,9 @@ struct get_patch
 
 struct get_index
 {
-    int i;
+    Foam::label i;
 
-    get_index(int i)
+    get_index(Foam::label i)
         : i(i)
     {}
 
@@ -87,9 +91,9 @@ struct get_index
 
 struct get_face
 {
-    int facei;
+    Foam::label facei;
 
-    get_face(int i)
+    get_face(Foam::label i)
         : facei(i)
     {}
 
@@ -115,12 +119,12 @@ struct get_face
 
 struct get_face_interp
 {
-    int facei;
-    int own;
-    int nei;
+    Foam::label facei;
+    Foam::label own;
+    Foam::label nei;
     Foam::scalar w;
 
-    get_face_interp(int i, const Foam::labelUList& owner, const Foam::labelUList& neighbour, const Foam::surfaceScalarField& weights)
+    get_face_interp(Foam::label i, const Foam::labelUList& owner, const Foam::labelUList& neighbour, const Foam::surfaceScalarField& weights)
         : facei(i)
         , own(owner[facei])
         , nei(neighbour[facei])
@@ -145,6 +149,28 @@ struct get_face_interp
     }
 };
 
+// Prefetches cell values of vol fields that get_face_interp of the same face
+// is going to read
+struct prefetch_face_interp
+{
+    Foam::label own;
+    Foam::label nei;
+
+    prefetch_face_interp(Foam::label facei, const Foam::labelUList& owner, const Foam::labelUList& neighbour)
+        : own(owner[facei])
+        , nei(neighbour[facei])
+    {}
+
+    template <typename Type, template<class> class PatchField>
+    void operator()(const Foam::GeometricField<Type, PatchField, Foam::surfaceMesh>& f) const {
+    }
+    template <typename Type, template<class> class PatchField>
+    void operator()(const Foam::GeometricField<Type, PatchField, Foam::volMesh>& f) const {
+        Foam::fve::prefetch_object(f[own]);
+        Foam::fve::prefetch_object(f[nei]);
+    }
+};
+
 template <typename Callable, typename... Fields>
 [[gnu::noinline]]
 void for_each_face_interp(Callable&& func, Fields&& ...fs) {
@@ -155,16 +181,23 @@ void for_each_face_interp(Callable&& func, Fields&& ...fs) {
     const auto& neighbour = mesh.neighbour();
 
     auto nInternalFaces = mesh.nInternalFaces();
-    for (int facei = 0; facei < nInternalFaces; ++facei) {
-        auto g = get_face_interp(facei, owner, neighbour, weights);
-        func(g(fs)...);
-    }
+    const Foam::label distance = Foam::fve::prefetch_distance();
+    Foam::fve::parallel_for(0, nInternalFaces, [&](Foam::label begin, Foam::label end) {
+        for (Foam::label facei = begin; facei < end; ++facei) {
+            if (distance > 0 && facei + distance < end) {
+                auto p = prefetch_face_interp(facei + distance, owner, neighbour);
+                (void)std::initializer_list<int>{(p(fs), 0)...};
+            }
+            auto g = get_face_interp(facei, owner, neighbour, weights);
+            func(g(fs)...);
+        }
+    });
 
-    for (int patchi = 0; patchi < mesh.boundary().size(); ++patchi) {
+    for (Foam::label patchi = 0; patchi < mesh.boundary().size(); ++patchi) {
         const Foam::fvPatch& patch = mesh.boundary()[patchi];
         auto patchfields = boost::mp11::tuple_transform(get_patch(patchi), fields);
-        int nFaces = patch.size();
-        for (int facei = 0; facei < nFaces; ++facei) {
+        Foam::label nFaces = patch.size();
+        for (Foam::label facei = 0; facei < nFaces; ++facei) {
             auto values = boost::mp11::tuple_transform(get_index(facei), patchfields);
             boost::mp11::tuple_apply(func, values);
         }
@@ -178,16 +211,16 @@ void for_each_face_interp(Callable&& func, Fields&& ...fs) {
 //    const Foam::fvMesh& mesh = std::get<0>(fields).mesh();
 
 //    auto nInternalFaces = mesh.nInternalFaces();
-//    for (int facei = 0; facei < nInternalFaces; ++facei) {
+//    for (Foam::label facei = 0; facei < nInternalFaces; ++facei) {
 //        auto g = get_face(facei);
 //        func(g(fs)...);
 //    }
 
-//    for (int patchi = 0; patchi < mesh.boundary().size(); ++patchi) {
+//    for (Foam::label patchi = 0; patchi < mesh.boundary().size(); ++patchi) {
 //        const Foam::fvPatch& patch = mesh.boundary()[patchi];
 //        auto patchfields = boost::mp11::tuple_transform(get_patch(patchi), fields);
-//        int nFaces = patch.size();
-//        for (int facei = 0; facei < nFaces; ++facei) {
+//        Foam::label nFaces = patch.size();
+//        for (Foam::label facei = 0; facei < nFaces; ++facei) {
 //            auto values = boost::mp11::tuple_transform(get_index(facei), patchfields);
 //            boost::mp11::tuple_apply(func, values);
 //        }
@@ -201,15 +234,17 @@ void for_each_cell(Callable&& func, Fields& ...fs) {
     const Foam::fvMesh& mesh = std::get<0>(fields).mesh();
 
     auto nCells = mesh.nCells();
-    for (int celli = 0; celli < nCells; ++celli) {
-        func(fs[celli]...);
-    }
+    Foam::fve::parallel_for(0, nCells, [&](Foam::label begin, Foam::label end) {
+        for (Foam::label celli = begin; celli < end; ++celli) {
+            func(fs[celli]...);
+        }
+    });
 
-    for (int patchi = 0; patchi < mesh.boundary().size(); ++patchi) {
+    for (Foam::label patchi = 0; patchi < mesh.boundary().size(); ++patchi) {
         const Foam::fvPatch& patch = mesh.boundary()[patchi];
         auto patchfields = boost::mp11::tuple_transform(get_patch(patchi), fields);
-        int nFaces = patch.size();
-        for (int facei = 0; facei < nFaces; ++facei) {
+        Foam::label nFaces = patch.size();
+        for (Foam::label facei = 0; facei < nFaces; ++facei) {
             auto values = boost::mp11::tuple_transform(get_index(facei), patchfields);
             boost::mp11::tuple_apply(func, values);
         }
@@ -226,7 +261,17 @@ void for_each_cell_neighbours(Callable&& func, Fields& ...fs) {
     const auto& neighbour = mesh.neighbour();
 
     auto nCells = mesh.nCells();
-    for (int celli = 0; celli < nCells; ++celli) {
+    const Foam::label distance = Foam::fve::prefetch_distance();
+    for (Foam::label celli = 0; celli < nCells; ++celli) {
+        if (distance > 0 && celli + distance < nCells) {
+            for (auto facei: mesh.cells()[celli + distance]) {
+                if (facei < mesh.nInternalFaces()) {
+                    auto p = prefetch_face_interp(facei, owner, neighbour);
+                    (void)std::initializer_list<int>{(p(fs), 0)...};
+                }
+            }
+        }
+
         const Foam::cell& c = mesh.cells()[celli];
 
         for (auto facei: c) {
@@ -239,11 +284,11 @@ void for_each_cell_neighbours(Callable&& func, Fields& ...fs) {
         }
     }
 
-    for (int patchi = 0; patchi < mesh.boundary().size(); ++patchi) {
+    for (Foam::label patchi = 0; patchi < mesh.boundary().size(); ++patchi) {
         const Foam::fvPatch& patch = mesh.boundary()[patchi];
         auto patchfields = boost::mp11::tuple_transform(get_patch(patchi), fields);
-        int nFaces = patch.size();
-        for (int facei = 0; facei < nFaces; ++facei) {
+        Foam::label nFaces = patch.size();
+        for (Foam::label facei = 0; facei < nFaces; ++facei) {
             auto values = boost::mp11::tuple_transform(get_index(facei), patchfields);
             boost::mp11::tuple_apply(func, values);
         }
@@ -0,0 +1,165 @@
+/*
+ *
+ * Copyright: 2023 Ilya Popov <ilya.popov@isteq.nl>, ISTEQ BV
+ *
+ * SPDX-License-Identifier: GPL3.0-or-later
+ *
+ */
+
+#include "zone_subsets.hpp"
+
+#include "cellZoneMesh.H"
+#include "faceZoneMesh.H"
+#include "defineDebugSwitch.H"
+
+namespace Foam {
+namespace fve {
+
+defineTypeNameAndDebug(zone_subsets, 0);
+
+} // namespace fve
+} // namespace Foam
+
+namespace {
+
+// Appends the runs of elements r with in_zone[i] != 0 to ranges
+void add_runs(const Foam::fve::index_range& r, const std::vector<char>& in_zone, std::vector<Foam::fve::index_range>& ranges)
+{
+    Foam::label start = -1;
+    for (auto i: r) {
+        if (in_zone[i] && start < 0) {
+            start = i;
+        }
+        else if (!in_zone[i] && start >= 0) {
+            ranges.push_back({start, i});
+            start = -1;
+        }
+    }
+    if (start >= 0) {
+        ranges.push_back({start, r.b});
+    }
+}
+
+// Builds the subset from the runs of every domain and the boundary faces of
+// the zone, given per domain
+Foam::fve::zone_subset make_subset(const Foam::fve::microdomains& mds,
+                                   const std::vector<std::vector<Foam::fve::index_range>>& domain_runs,
+                                   const std::vector<std::vector<Foam::fve::patch_face>>& domain_patch_faces)
+{
+    Foam::fve::zone_subset z;
+    z.mask.assign(mds.domains.size(), 0);
+
+    for (size_t d = 0; d < mds.domains.size(); ++d) {
+        if (domain_runs[d].empty() && domain_patch_faces[d].empty()) {
+            continue;
+        }
+        z.domains.push_back(d);
+        z.mask[d] = 1;
+
+        Foam::label ranges_start = z.ranges.size();
+        z.ranges.insert(z.ranges.end(), domain_runs[d].begin(), domain_runs[d].end());
+        z.domain_ranges.push_back({ranges_start, static_cast<Foam::label>(z.ranges.size())});
+
+        Foam::label faces_start = z.patch_faces.size();
+        z.patch_faces.insert(z.patch_faces.end(), domain_patch_faces[d].begin(), domain_patch_faces[d].end());
+        z.domain_patch_faces.push_back({faces_start, static_cast<Foam::label>(z.patch_faces.size())});
+    }
+    return z;
+}
+
+} // namespace
+
+Foam::fve::zone_subsets::zone_subsets(const fvMesh &mesh)
+    : Foam::MeshObject<Foam::fvMesh, Foam::TopologicalMeshObject, zone_subsets>(mesh)
+{
+}
+
+Foam::fve::zone_subsets::~zone_subsets()
+{
+
+}
+
+const Foam::fve::zone_subset& Foam::fve::zone_subsets::cell_zone(const Foam::word& name) const
+{
+    auto it = cell_zones_.find(name);
+    if (it != cell_zones_.end()) {
+        return it->second;
+    }
+
+    const fvMesh& mesh = mesh_;
+    const microdomains& mds = microdomains::New(mesh);
+
+    Foam::label zonei = mesh.cellZones().findZoneID(name);
+    if (zonei < 0) {
+        Foam::FatalError << "Cell zone " << name << " not found" << Foam::abort(Foam::FatalError);
+    }
+
+    std::vector<char> in_zone(mesh.nCells(), 0);
+    for (auto celli: mesh.cellZones()[zonei]) {
+        in_zone[celli] = 1;
+    }
+
+    std::vector<std::vector<index_range>> domain_runs(mds.domains.size());
+    for (size_t d = 0; d < mds.domains.size(); ++d) {
+        add_runs(mds.domains[d].cells, in_zone, domain_runs[d]);
+    }
+
+    std::vector<std::vector<patch_face>> domain_patch_faces(mds.domains.size());
+    for (Foam::label patchi = 0; patchi < mesh.boundary().size(); patchi++) {
+        const Foam::labelUList& faceCells = mesh.boundary()[patchi].faceCells();
+        for (Foam::label facei = 0; facei < faceCells.size(); facei++) {
+            Foam::label celli = faceCells[facei];
+            if (in_zone[celli]) {
+                domain_patch_faces[mds.cell_dist[celli]].push_back(patch_face{patchi, facei, celli});
+            }
+        }
+    }
+
+    return cell_zones_[name] = make_subset(mds, domain_runs, domain_patch_faces);
+}
+
+const Foam::fve::zone_subset& Foam::fve::zone_subsets::face_zone(const Foam::word& name) const
+{
+    auto it = face_zones_.find(name);
+    if (it != face_zones_.end()) {
+        return it->second;
+    }
+
+    const fvMesh& mesh = mesh_;
+    const microdomains& mds = microdomains::New(mesh);
+
+    Foam::label zonei = mesh.faceZones().findZoneID(name);
+    if (zonei < 0) {
+        Foam::FatalError << "Face zone " << name << " not found" << Foam::abort(Foam::FatalError);
+    }
+
+    std::vector<char> in_zone(mesh.nFaces(), 0);
+    for (auto facei: mesh.faceZones()[zonei]) {
+        in_zone[facei] = 1;
+    }
+
+    std::vector<std::vector<index_range>> domain_runs(mds.domains.size());
+    for (size_t d = 0; d < mds.domains.size(); ++d) {
+        const microdomain& md = mds.domains[d];
+        if (!md.internal_faces.empty()) {
+            add_runs(md.internal_faces, in_zone, domain_runs[d]);
+        }
+        if (!md.own_boundary_faces.empty()) {
+            add_runs(md.own_boundary_faces, in_zone, domain_runs[d]);
+        }
+    }
+
+    std::vector<std::vector<patch_face>> domain_patch_faces(mds.domains.size());
+    for (Foam::label patchi = 0; patchi < mesh.boundary().size(); patchi++) {
+        const Foam::fvPatch& patch = mesh.boundary()[patchi];
+        const Foam::labelUList& faceCells = patch.faceCells();
+        for (Foam::label facei = 0; facei < patch.size(); facei++) {
+            if (in_zone[patch.start() + facei]) {
+                Foam::label celli = faceCells[facei];
+                domain_patch_faces[mds.cell_dist[celli]].push_back(patch_face{patchi, facei, celli});
+            }
+        }
+    }
+
+    return face_zones_[name] = make_subset(mds, domain_runs, domain_patch_faces);
+}
@@ -0,0 +1,145 @@
+/*
+ *
+ * Copyright: 2023 Ilya Popov <ilya.popov@isteq.nl>, ISTEQ BV
+ *
+ * SPDX-License-Identifier: GPL3.0-or-later
+ *
+ */
+
+#pragma once
+
+#include "expressions.hpp"
+
+#include "microdomains.hpp"
+#include "process_microdomains.hpp"
+#include "thread_pool.hpp"
+
+#include "fvMesh.H"
+#include "MeshObject.H"
+
+#include <map>
+#include <vector>
+
+namespace Foam {
+namespace fve {
+
+// Cells of a cellZone or faces of a faceZone, split by microdomain into
+// contiguous runs, so that evaluating an expression on the zone keeps the
+// domain order of full assignments.
+struct zone_subset {
+    // Domains containing elements of the zone, in order
+    std::vector<domain_label> domains;
+
+    // For domains[i]: range of its runs in ranges and of its boundary faces
+    // in patch_faces
+    std::vector<index_range> domain_ranges;
+    std::vector<index_range> domain_patch_faces;
+
+    // Runs of cells (cellZone) or internal faces (faceZone)
+    std::vector<index_range> ranges;
+
+    // Boundary faces of the zone: for a cellZone the faces of all patches
+    // next to its cells, for a faceZone its faces on patches
+    std::vector<patch_face> patch_faces;
+
+    // mask[d] != 0 for the domains in domains
+    std::vector<char> mask;
+};
+
+// Zone subsets of a mesh, built on first use
+struct zone_subsets : public Foam::MeshObject<Foam::fvMesh, Foam::TopologicalMeshObject, zone_subsets> {
+    TypeName("zone_subsets");
+
+    explicit zone_subsets(const Foam::fvMesh& mesh);
+    virtual ~zone_subsets();
+
+    const zone_subset& cell_zone(const Foam::word& name) const;
+    const zone_subset& face_zone(const Foam::word& name) const;
+
+private:
+    mutable std::map<Foam::word, zone_subset> cell_zones_;
+    mutable std::map<Foam::word, zone_subset> face_zones_;
+};
+
+///////////////////////////////////////////////////////////////////////////////
+
+// Evaluates e on the runs of a zone subset domain by domain, calling
+// assign(i) for its cells or internal faces and assign_patch(patchi, facei)
+// for its boundary faces. Surface integrals are computed only on the domains
+// of the zone and as many layers of neighbours as the levels need: one for
+// gathers of the outermost level and one more per level below.
+template <typename Expression, typename Assign, typename AssignPatch>
+void assign_zone_subset(const Expression& e, const zone_subset& z, Assign&& assign, AssignPatch&& assign_patch)
+{
+    const auto& mds = microdomains::New(e.mesh());
+
+    std::vector<std::vector<char>> masks(Expression::integrate_depth + 1);
+    std::vector<std::vector<char>> reach(Expression::integrate_depth + 1);
+    for (int level = Expression::integrate_depth; level >= 1; --level) {
+        masks[level] = expand(mds, level == Expression::integrate_depth ? z.mask : masks[level + 1]);
+        reach[level] = expand(mds, masks[level]);
+    }
+
+    thread_pool::instance().run([&](const thread_pool::team& t) {
+        process_microdomains(e, mds, masks, reach, t);
+
+        chunk c(0, z.domains.size(), t);
+        for (Foam::label i = c.begin; i < c.end; ++i) {
+            for (auto ri: z.domain_ranges[i]) {
+                const index_range& r = z.ranges[ri];
+                for_each_element(e, r.a, r.b, assign);
+            }
+            for (auto pi: z.domain_patch_faces[i]) {
+                const patch_face& pf = z.patch_faces[pi];
+                assign_patch(pf.patchi, pf.facei);
+            }
+        }
+    });
+}
+
+// Same as f <<= e, but only on the cells of a cellZone and on the boundary
+// faces next to them. Other values of f are left unchanged. Surface integrals
+// in e are also computed around the zone, so their fields must not be f.
+template <typename Type, template<class> class PatchField, typename Expression>
+[[gnu::noinline]]
+void assign_cell_zone(Foam::GeometricField<Type, PatchField, Foam::volMesh>& f, const Foam::word& zone, Expression e)
+{
+    static_assert(Expression::location == loc::cell,
+                  "Expression must have same location (cell or face) as the target field");
+
+    if (!e.dimensions().dimensionless()) {
+        // Check dimensions
+        f.dimensions() = e.dimensions();
+    }
+
+    auto& bf = f.boundaryFieldRef();
+    assign_zone_subset(e, zone_subsets::New(e.mesh()).cell_zone(zone), [&](Foam::label celli) {
+        f[celli] = e[celli];
+    }, [&](Foam::label patchi, Foam::label facei) {
+        bf[patchi][facei] = e.on_boundary(patchi, facei);
+    });
+}
+
+// Same as f <<= e, but only on the faces of a faceZone
+template <typename Type, template<class> class PatchField, typename Expression>
+[[gnu::noinline]]
+void assign_face_zone(Foam::GeometricField<Type, PatchField, Foam::surfaceMesh>& f, const Foam::word& zone, Expression e)
+{
+    static_assert(Expression::location == loc::face,
+                  "Expression must have same location (cell or face) as the target field");
+
+    if (!e.dimensions().dimensionless()) {
+        // Check dimensions
+        f.dimensions() = e.dimensions();
+    }
+
+    auto& bf = f.boundaryFieldRef();
+    assign_zone_subset(e, zone_subsets::New(e.mesh()).face_zone(zone), [&](Foam::label facei) {
+        f[facei] = e[facei];
+    }, [&](Foam::label patchi, Foam::label facei) {
+        bf[patchi][facei] = e.on_boundary(patchi, facei);
+    });
+}
+
+} // namespace fve
+} // namespace Foam
@@ -4,18 +4,92 @@ set -eu
 
 series="my_machine-4k"
 
+# Cell orderings to compare: "cuthillmckee" uses renumberMesh with
+# system/renumberMeshDict, "hilbert", "morton" and "random" (shuffled cells)
+# use sfcRenumberMesh
+orderings="cuthillmckee hilbert random"
+block_size=4000
+
+# Mesh types to compare at about the same cell count: "hex" from
+# system/blockMeshDict.template, "tet" (unstructured tetrahedra), "prism"
+# (extruded triangulation) and "poly" (polyDualMesh of tetrahedra) from
+# system/<type>.geo.template, which need gmsh
+mesh_types="hex tet prism poly"
+
 results_dir="benchmarking/$series"
 mkdir -p "$results_dir"
 
+# Count cache misses of the whole benchmark run if perf is available
+if command -v perf > /dev/null 2>&1; then
+    have_perf=1
+else
+    have_perf=0
+fi
+
+if ! command -v gmsh > /dev/null 2>&1; then
+    echo "gmsh not found, benchmarking hex meshes only"
+    mesh_types="hex"
+fi
+
+# make_mesh <type> <n>: writes constant/polyMesh of about n^3 cells
+make_mesh() {
+    case "$1" in
+        hex)
+            sed "s/NNN/$2/g" system/blockMeshDict.template > system/blockMeshDict
+            blockMesh
+            ;;
+        *)
+            sed "s/NNN/$2/g" "system/$1.geo.template" > system/mesh.geo
+            gmsh -3 -format msh22 -o constant/mesh.msh system/mesh.geo
+            gmshToFoam constant/mesh.msh
+            rm -f constant/mesh.msh
+            # The Physical Volume, needed for gmsh to write the cells, becomes
+            # a cellZone, which sfcRenumberMesh does not support. The zones
+            # of the benchmark are made by topoSet after renumbering.
+            rm -f constant/polyMesh/cellZones constant/polyMesh/faceZones constant/polyMesh/pointZones
+            if [ "$1" = poly ]; then
+                polyDualMesh -overwrite 80
+            fi
+            ;;
+    esac
+
+    # The header of owner notes the cell count
+    cells=$(sed -n 's/.*nCells: *\([0-9]*\).*/\1/p' constant/polyMesh/owner | head -n 1)
+    target=$(( $2 * $2 * $2 ))
+    if [ -n "$cells" ] && { [ "$cells" -lt $(( target * 3 / 4 )) ] || [ "$cells" -gt $(( target * 4 / 3 )) ]; }; then
+        echo "warning: $1 mesh has $cells cells, expected about $target"
+    fi
+}
+
 #for n in 15 16 17 18 19 20  22  23  25  27  29  32  34  37  40  43  47  50  54  59  63  68  74  80  86  93 100 108 117 126 136 147 159 172 185 200
 #for n in 16 17 18 19 20  22  23  25  27  29  32  34  37  40  43  47  50  54  59  63  68  74  80  86  93 100 108 117 126 136
 #for n in 16 17 18 19 20  22  23  25  27  29  32  34  37  40  43  47  50  54  59  63  68  74  80  86  93 100 108 117
 do
-    rm -rf 1 constant/cellDist
-    sed "s/NNN/$n/g" system/blockMeshDict.template > system/blockMeshDict
-    blockMesh
-    renumberMesh -dict system/renumberMeshDict -constant
-    field_traversal_benchmark
-    mv results.csv "$results_dir/results-$n.csv"
+    for mesh_type in $mesh_types
+    do
+        for ordering in $orderings
+        do
+            rm -rf 0 1 constant/cellDist constant/polyMesh
+            make_mesh "$mesh_type" "$n"
+            case "$ordering" in
+                cuthillmckee)
+                    renumberMesh -dict system/renumberMeshDict -constant
+                    ;;
+                *)
+                    sfcRenumberMesh -curve "$ordering" -blockSize "$block_size"
+                    ;;
+            esac
+            topoSet
+            name="$mesh_type-$ordering-$n"
+            if [ "$have_perf" -eq 1 ]; then
+                perf stat -e cache-references,cache-misses,LLC-load-misses -o "$results_dir/perf-$name.txt" field_traversal_benchmark
+            else
+                field_traversal_benchmark
+            fi
+            for f in results*.csv
+            do
+                mv "$f" "$results_dir/${f%.csv}-$name.csv"
+            done
+        done
+    done
 done
-